@@ -0,0 +1,277 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Video (and audio) capture.
+ *
+ * Finished frames are copied into one of a small number of slots, and a
+ * writer thread converts and writes them out, so the emulation never waits
+ * on the disk.  If all the slots are full the frame is dropped (and
+ * counted) instead.  Audio goes through a RECORDER (recorder.c), which
+ * does the same for it with a ring buffer and a writer of its own.
+ *
+ * Frames are written as YUV4MPEG2 (.y4m, which most players and ffmpeg
+ * read directly), or, if the filename ends in .raw and the frame is indexed
+ * (-i), as bare 320x240 bytes of color numbers, with the palette beside it
+ * as 256 RGB triplets in a .pal file.  Audio goes to a .wav beside it.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "capture.h"
+#include "recorder.h"
+
+#define CAP_SLOTS 16     /* frames queued for the writer               */
+#define CAP_PIXELS (CAPTURE_W*CAPTURE_H)
+
+/*
+ * NABU frame rate: the 3.579545 MHz clock over 262 lines of 228 cycles,
+ * just under 60 Hz.
+ */
+#define CAP_FPS "F3579545:59736"
+
+static FILE *video;
+static int raw, indexed;
+static const uint32_t *palette;
+static int frame_bytes;
+
+static uint8_t *slot[CAP_SLOTS];
+static int slot_in, slot_out;
+static SDL_sem *free_slots, *full_slots;
+static SDL_Thread *writer;
+static volatile int stopping;
+
+static RECORDER audio;
+
+static uint8_t *yuv;
+
+unsigned long capture_frames, capture_dropped;
+
+static uint32_t cap_rgb (const uint8_t *frame, int i)
+{
+ if (indexed) return palette[frame[i]];
+ return ((const uint32_t *)frame)[i];
+}
+
+/*
+ * RGB to BT.601 studio-range YCbCr, 4:2:0, chroma from the average of each
+ * 2x2 block.
+ */
+static void write_y4m (const uint8_t *frame)
+{
+ uint8_t *y, *u, *v;
+ int px, py, i, r, g, b;
+ uint32_t c;
+
+ y=yuv;
+ u=y+CAP_PIXELS;
+ v=u+CAP_PIXELS/4;
+
+ for (i=0; i<CAP_PIXELS; i++)
+ {
+  c=cap_rgb(frame, i);
+  r=(c>>16)&0xFF; g=(c>>8)&0xFF; b=c&0xFF;
+  y[i]=16+((66*r+129*g+25*b+128)>>8);
+ }
+
+ for (py=0; py<CAPTURE_H; py+=2)
+  for (px=0; px<CAPTURE_W; px+=2)
+  {
+   r=g=b=0;
+   for (i=0; i<4; i++)
+   {
+    c=cap_rgb(frame, (py+(i>>1))*CAPTURE_W+px+(i&1));
+    r+=(c>>16)&0xFF; g+=(c>>8)&0xFF; b+=c&0xFF;
+   }
+   r>>=2; g>>=2; b>>=2;
+   i=(py/2)*(CAPTURE_W/2)+px/2;
+   u[i]=128+((-38*r-74*g+112*b+128)>>8);
+   v[i]=128+((112*r-94*g-18*b+128)>>8);
+  }
+
+ fputs("FRAME\n", video);
+ fwrite(yuv, 1, CAP_PIXELS*3/2, video);
+}
+
+static int capture_writer (void *unused)
+{
+ (void)unused;
+
+ while (1)
+ {
+  /* Wake up now and then even without a frame, to see if it's time to stop. */
+  if (!SDL_SemWaitTimeout(full_slots, 50))
+  {
+   if (raw)
+    fwrite(slot[slot_out], 1, frame_bytes, video);
+   else
+    write_y4m(slot[slot_out]);
+   slot_out=(slot_out+1)%CAP_SLOTS;
+   SDL_SemPost(free_slots);
+  }
+  else if (stopping)
+   break;
+ }
+ return 0;
+}
+
+/*
+ * Start capturing to filename.  indexed says whether frames will be 8-bit
+ * color numbers (looked up in palette) or ARGB8888.  Returns 0 on success.
+ */
+int capture_open (char *filename, int is_indexed, const uint32_t *pal,
+                  int with_audio, int rate)
+{
+ char *wavname;
+ size_t l;
+ int i;
+
+ indexed=is_indexed;
+ palette=pal;
+ l=strlen(filename);
+ raw=(l>4)&&(!strcmp(filename+l-4, ".raw"));
+ if (raw&&!indexed)
+ {
+  fprintf(stderr, "%s: raw capture needs an indexed frame (-i)\n", filename);
+  return -1;
+ }
+ frame_bytes=indexed?CAP_PIXELS:CAP_PIXELS*4;
+
+ video=fopen(filename, "wb");
+ if (!video)
+ {
+  perror(filename);
+  return -1;
+ }
+
+ /* name.y4m -> name.pal, name.wav */
+ wavname=malloc(l+5);
+ if (!wavname)
+  return -1;
+ strcpy(wavname, filename);
+ if ((l>4)&&(wavname[l-4]=='.')) wavname[l-4]=0;
+
+ if (raw)
+ {
+  FILE *pal_file;
+
+  strcat(wavname, ".pal");
+  pal_file=fopen(wavname, "wb");
+  if (pal_file)
+  {
+   for (i=0; i<256; i++)
+   {
+    fputc((palette[i]>>16)&0xFF, pal_file);
+    fputc((palette[i]>>8)&0xFF, pal_file);
+    fputc(palette[i]&0xFF, pal_file);
+   }
+   fclose(pal_file);
+  }
+  else
+   perror(wavname);
+  wavname[strlen(wavname)-4]=0;
+ }
+ else
+ {
+  fprintf(video, "YUV4MPEG2 W%d H%d " CAP_FPS " Ip A1:1 C420jpeg\n",
+          CAPTURE_W, CAPTURE_H);
+  yuv=malloc(CAP_PIXELS*3/2);
+  if (!yuv) return -1;
+ }
+
+ if (with_audio)
+ {
+  strcat(wavname, ".wav");
+  recorder_wav_open(&audio, wavname, rate);
+ }
+ free(wavname);
+
+ for (i=0; i<CAP_SLOTS; i++)
+ {
+  slot[i]=malloc(frame_bytes);
+  if (!slot[i]) return -1;
+ }
+ free_slots=SDL_CreateSemaphore(CAP_SLOTS);
+ full_slots=SDL_CreateSemaphore(0);
+ if ((!free_slots)||(!full_slots)) return -1;
+
+ writer=SDL_CreateThread(capture_writer, "capture", NULL);
+ return writer?0:-1;
+}
+
+/* Queue a finished frame, or drop it if the writer is too far behind. */
+void capture_frame (const void *frame)
+{
+ if (!writer) return;
+
+ if (SDL_SemTryWait(free_slots))
+ {
+  capture_dropped++;
+  return;
+ }
+ memcpy(slot[slot_in], frame, frame_bytes);
+ slot_in=(slot_in+1)%CAP_SLOTS;
+ capture_frames++;
+ SDL_SemPost(full_slots);
+}
+
+/* Queue n samples of audio, from the audio callback.  Never waits. */
+void capture_audio (const int16_t *samples, int n)
+{
+ recorder_wav_put(&audio, samples, n);
+}
+
+void capture_close (void)
+{
+ int i;
+
+ if (writer)
+ {
+  stopping=1;
+  SDL_WaitThread(writer, NULL);
+  writer=NULL;
+ }
+
+ recorder_wav_close(&audio);
+ if (video)
+ {
+  fclose(video);
+  video=NULL;
+  printf("Captured %lu frames (%lu dropped)\n", capture_frames,
+         capture_dropped);
+  if (audio.dropped)
+   printf("%lu samples of audio dropped\n", audio.dropped/2);
+ }
+
+ for (i=0; i<CAP_SLOTS; i++)
+ {
+  free(slot[i]);
+  slot[i]=NULL;
+ }
+ free(yuv);
+ yuv=NULL;
+ if (free_slots) SDL_DestroySemaphore(free_slots);
+ if (full_slots) SDL_DestroySemaphore(full_slots);
+ free_slots=full_slots=NULL;
+}
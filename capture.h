@@ -0,0 +1,39 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef H_CAPTURE
+#define H_CAPTURE
+
+#include <stdint.h>
+
+#define CAPTURE_W 320
+#define CAPTURE_H 240
+
+int capture_open (char *filename, int indexed, const uint32_t *palette,
+                  int with_audio, int rate);
+void capture_close (void);
+
+void capture_frame (const void *frame);
+void capture_audio (const int16_t *samples, int n);
+
+extern unsigned long capture_frames, capture_dropped;
+
+#endif /* H_CAPTURE */
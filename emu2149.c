@@ -29,6 +29,7 @@
  * - AY-3-8910 data sheet
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include "emu2149.h"
@@ -54,6 +55,171 @@ static const uint8_t regmsk[16] = {
 
 #define GETA_BITS 24
 
+/*
+ * Band-limited steps.  At PSG_QUALITY_BLEP every change in the output goes
+ * in as a step that has been through a low-pass filter (a windowed sinc),
+ * at the point between two samples where it happened, rather than landing
+ * whole on the next sample.  blep_table holds the filter's impulse
+ * response, BLEP_TAPS samples of it for each of BLEP_PHASES + 1 positions
+ * between two samples; a step is added into blep_buf from it, and the
+ * samples are the running sum of what comes out of blep_buf.  Each row
+ * adds up to exactly 1 << BLEP_BITS, so every step ends up exactly the
+ * right height.  The output is BLEP_TAPS / 2 samples late.
+ */
+#define BLEP_TAPS 16
+#define BLEP_PHASES 64
+#define BLEP_BITS 15
+
+/*
+ * Row p is a Blackman-windowed sinc, cut off at 0.9 of the Nyquist
+ * frequency, for a step p / BLEP_PHASES of a sample after the tap before
+ * the middle one.  It was worked out in doubles, scaled to 1 << BLEP_BITS
+ * and rounded, and the rounding error put back on the largest tap.  It is
+ * kept here as numbers so no maths library is needed.
+ */
+static const int32_t blep_table[BLEP_PHASES + 1][BLEP_TAPS] = {
+  {18, -110, 359, -843, 1561, -2371, 3025, 29490,
+   3025, -2371, 1561, -843, 359, -110, 18, 0},
+  {18, -109, 353, -820, 1492, -2199, 2566, 29481,
+   3495, -2543, 1628, -866, 364, -110, 18, 0},
+  {17, -108, 347, -795, 1421, -2025, 2117, 29452,
+   3974, -2714, 1693, -887, 369, -111, 18, 0},
+  {17, -107, 340, -769, 1349, -1852, 1679, 29400,
+   4463, -2883, 1757, -906, 373, -111, 18, 0},
+  {17, -105, 332, -742, 1276, -1679, 1252, 29332,
+   4960, -3051, 1818, -925, 376, -110, 17, 0},
+  {17, -104, 324, -715, 1202, -1507, 837, 29242,
+   5467, -3215, 1876, -941, 378, -110, 17, 0},
+  {16, -102, 315, -686, 1128, -1335, 434, 29131,
+   5981, -3378, 1932, -956, 380, -109, 17, 0},
+  {16, -100, 306, -657, 1052, -1165, 43, 29003,
+   6502, -3537, 1986, -970, 381, -108, 16, 0},
+  {16, -98, 297, -627, 977, -997, -336, 28853,
+   7031, -3693, 2036, -982, 381, -106, 16, 0},
+  {15, -95, 287, -597, 900, -830, -702, 28688,
+   7565, -3845, 2083, -991, 380, -105, 15, 0},
+  {15, -93, 277, -566, 824, -665, -1055, 28499,
+   8106, -3992, 2127, -999, 378, -103, 15, 0},
+  {14, -90, 267, -535, 748, -503, -1395, 28293,
+   8652, -4135, 2167, -1005, 376, -100, 14, 0},
+  {14, -87, 256, -503, 672, -343, -1721, 28067,
+   9203, -4273, 2204, -1009, 372, -97, 13, 0},
+  {13, -85, 245, -471, 597, -187, -2034, 27825,
+   9759, -4405, 2237, -1011, 367, -94, 12, 0},
+  {13, -82, 234, -439, 522, -34, -2334, 27565,
+   10317, -4531, 2266, -1011, 362, -91, 11, 0},
+  {12, -79, 223, -407, 447, 116, -2619, 27287,
+   10879, -4652, 2291, -1008, 355, -87, 10, 0},
+  {12, -76, 211, -375, 374, 262, -2891, 26992,
+   11444, -4765, 2311, -1004, 348, -83, 8, 0},
+  {11, -73, 200, -343, 301, 405, -3149, 26678,
+   12010, -4871, 2328, -997, 339, -78, 7, 0},
+  {10, -69, 188, -311, 229, 543, -3394, 26350,
+   12577, -4970, 2339, -987, 330, -73, 6, 0},
+  {10, -66, 177, -279, 159, 677, -3624, 26005,
+   13145, -5061, 2346, -976, 319, -68, 4, 0},
+  {9, -63, 165, -248, 90, 807, -3840, 25646,
+   13712, -5144, 2348, -962, 308, -62, 2, 0},
+  {9, -60, 153, -217, 22, 932, -4042, 25268,
+   14279, -5218, 2346, -945, 295, -56, 1, 1},
+  {8, -56, 142, -186, -44, 1052, -4231, 24877,
+   14845, -5283, 2338, -926, 282, -50, -1, 1},
+  {8, -53, 130, -156, -108, 1167, -4405, 24473,
+   15409, -5339, 2325, -905, 267, -43, -3, 1},
+  {7, -50, 119, -126, -171, 1277, -4566, 24057,
+   15970, -5386, 2307, -881, 251, -36, -5, 1},
+  {7, -47, 107, -96, -232, 1382, -4713, 23625,
+   16527, -5422, 2284, -854, 235, -28, -8, 1},
+  {6, -44, 96, -68, -291, 1482, -4846, 23182,
+   17081, -5448, 2255, -825, 217, -21, -10, 2},
+  {6, -40, 85, -39, -348, 1577, -4966, 22723,
+   17630, -5463, 2221, -794, 198, -12, -12, 2},
+  {5, -37, 74, -12, -403, 1666, -5072, 22257,
+   18174, -5467, 2182, -760, 178, -4, -15, 2},
+  {5, -34, 64, 15, -456, 1750, -5165, 21777,
+   18711, -5460, 2137, -724, 158, 5, -17, 2},
+  {4, -31, 53, 41, -506, 1828, -5246, 21289,
+   19243, -5441, 2086, -685, 136, 14, -20, 3},
+  {4, -28, 43, 66, -554, 1901, -5313, 20790,
+   19767, -5411, 2030, -644, 114, 23, -23, 3},
+  {3, -25, 33, 90, -600, 1968, -5368, 20283,
+   20283, -5368, 1968, -600, 90, 33, -25, 3},
+  {3, -23, 23, 114, -644, 2030, -5411, 19767,
+   20790, -5313, 1901, -554, 66, 43, -28, 4},
+  {3, -20, 14, 136, -685, 2086, -5441, 19243,
+   21289, -5246, 1828, -506, 41, 53, -31, 4},
+  {2, -17, 5, 158, -724, 2137, -5460, 18711,
+   21777, -5165, 1750, -456, 15, 64, -34, 5},
+  {2, -15, -4, 178, -760, 2182, -5467, 18174,
+   22257, -5072, 1666, -403, -12, 74, -37, 5},
+  {2, -12, -12, 198, -794, 2221, -5463, 17630,
+   22723, -4966, 1577, -348, -39, 85, -40, 6},
+  {2, -10, -21, 217, -825, 2255, -5448, 17081,
+   23182, -4846, 1482, -291, -68, 96, -44, 6},
+  {1, -8, -28, 235, -854, 2284, -5422, 16527,
+   23625, -4713, 1382, -232, -96, 107, -47, 7},
+  {1, -5, -36, 251, -881, 2307, -5386, 15970,
+   24057, -4566, 1277, -171, -126, 119, -50, 7},
+  {1, -3, -43, 267, -905, 2325, -5339, 15409,
+   24473, -4405, 1167, -108, -156, 130, -53, 8},
+  {1, -1, -50, 282, -926, 2338, -5283, 14845,
+   24877, -4231, 1052, -44, -186, 142, -56, 8},
+  {1, 1, -56, 295, -945, 2346, -5218, 14279,
+   25268, -4042, 932, 22, -217, 153, -60, 9},
+  {0, 2, -62, 308, -962, 2348, -5144, 13712,
+   25646, -3840, 807, 90, -248, 165, -63, 9},
+  {0, 4, -68, 319, -976, 2346, -5061, 13145,
+   26005, -3624, 677, 159, -279, 177, -66, 10},
+  {0, 6, -73, 330, -987, 2339, -4970, 12577,
+   26350, -3394, 543, 229, -311, 188, -69, 10},
+  {0, 7, -78, 339, -997, 2328, -4871, 12010,
+   26678, -3149, 405, 301, -343, 200, -73, 11},
+  {0, 8, -83, 348, -1004, 2311, -4765, 11444,
+   26992, -2891, 262, 374, -375, 211, -76, 12},
+  {0, 10, -87, 355, -1008, 2291, -4652, 10879,
+   27287, -2619, 116, 447, -407, 223, -79, 12},
+  {0, 11, -91, 362, -1011, 2266, -4531, 10317,
+   27565, -2334, -34, 522, -439, 234, -82, 13},
+  {0, 12, -94, 367, -1011, 2237, -4405, 9759,
+   27825, -2034, -187, 597, -471, 245, -85, 13},
+  {0, 13, -97, 372, -1009, 2204, -4273, 9203,
+   28067, -1721, -343, 672, -503, 256, -87, 14},
+  {0, 14, -100, 376, -1005, 2167, -4135, 8652,
+   28293, -1395, -503, 748, -535, 267, -90, 14},
+  {0, 15, -103, 378, -999, 2127, -3992, 8106,
+   28499, -1055, -665, 824, -566, 277, -93, 15},
+  {0, 15, -105, 380, -991, 2083, -3845, 7565,
+   28688, -702, -830, 900, -597, 287, -95, 15},
+  {0, 16, -106, 381, -982, 2036, -3693, 7031,
+   28853, -336, -997, 977, -627, 297, -98, 16},
+  {0, 16, -108, 381, -970, 1986, -3537, 6502,
+   29003, 43, -1165, 1052, -657, 306, -100, 16},
+  {0, 17, -109, 380, -956, 1932, -3378, 5981,
+   29131, 434, -1335, 1128, -686, 315, -102, 16},
+  {0, 17, -110, 378, -941, 1876, -3215, 5467,
+   29242, 837, -1507, 1202, -715, 324, -104, 17},
+  {0, 17, -110, 376, -925, 1818, -3051, 4960,
+   29332, 1252, -1679, 1276, -742, 332, -105, 17},
+  {0, 18, -111, 373, -906, 1757, -2883, 4463,
+   29400, 1679, -1852, 1349, -769, 340, -107, 17},
+  {0, 18, -111, 369, -887, 1693, -2714, 3974,
+   29452, 2117, -2025, 1421, -795, 347, -108, 17},
+  {0, 18, -110, 364, -866, 1628, -2543, 3495,
+   29481, 2566, -2199, 1492, -820, 353, -109, 18},
+  {0, 18, -110, 359, -843, 1561, -2371, 3025,
+   29490, 3025, -2371, 1561, -843, 359, -110, 18}
+};
+
+/* Start the band-limited output off at the level the channels are at */
+static void
+blep_clear (PSG * psg)
+{
+  memset (psg->blep_buf, 0, sizeof (psg->blep_buf));
+  psg->blep_level = psg->ch_out[0] + psg->ch_out[1] + psg->ch_out[2];
+  psg->blep_sum = psg->blep_level << BLEP_BITS;
+  psg->blep_pos = 0;
+}
+
 static void
 internal_refresh (PSG * psg)
 {
@@ -62,7 +228,7 @@ internal_refresh (PSG * psg)
   if (psg->clk_div)
     f_master /= 2;
 
-  if (psg->quality)
+  if (psg->quality == PSG_QUALITY_HIGH)
   {
     psg->base_incr = 1 << GETA_BITS;
     psg->realstep = f_master;
@@ -74,6 +240,12 @@ internal_refresh (PSG * psg)
   {
     psg->base_incr = (uint32_t)((double)f_master * (1 << GETA_BITS) / 8 / psg->rate);
     psg->freq_limit = 0;
+
+    if (psg->quality == PSG_QUALITY_BLEP)
+    {
+      /* Tones above the Nyquist frequency are held, as at high quality */
+      psg->freq_limit = (uint32_t)(f_master / 16 / (psg->rate / 2));
+    }
   }
 }
 
@@ -111,6 +283,7 @@ PSG_setQuality (PSG * psg, uint8_t q)
   if (psg->quality != q) {
     psg->quality = q;
     internal_refresh(psg);
+    blep_clear(psg);
   }
 }
 
@@ -148,6 +321,7 @@ PSG_setVolumeMode (PSG * psg, int type)
     psg->voltbl = voltbl[0]; /* fallback: YM2149 */
     break;
   }
+  psg->blep_dirty = 1;
 }
 
 uint32_t
@@ -158,6 +332,7 @@ PSG_setMask (PSG *psg, uint32_t mask)
   {
     ret = psg->mask;
     psg->mask = mask;
+    psg->blep_dirty = 1;
   }  
   return ret;
 }
@@ -170,6 +345,7 @@ PSG_toggleMask (PSG *psg, uint32_t mask)
   {
     ret = psg->mask;
     psg->mask ^= mask;
+    psg->blep_dirty = 1;
   }
   return ret;
 }
@@ -207,6 +383,7 @@ PSG_reset (PSG * psg)
   psg->env_pause = 1;
 
   psg->out = 0;
+  blep_clear (psg);
 
 }
 
@@ -237,11 +414,91 @@ PSG_writeIO (PSG * psg, uint32_t adr, uint32_t val)
     psg->adr = val & 0x1f;
 }
 
+/* The envelope counter has reached its period */
 static inline void
-update_output (PSG * psg)
+env_step (PSG * psg)
+{
+  if (!psg->env_pause)
+  {
+    if(psg->env_face)
+      psg->env_ptr = (psg->env_ptr + 1) & 0x3f ; 
+    else
+      psg->env_ptr = (psg->env_ptr + 0x3f) & 0x3f;
+  }
+
+  if (psg->env_ptr & 0x20) /* if carry or borrow */
+  {
+    if (psg->env_continue)
+    {
+      if (psg->env_alternate^psg->env_hold) psg->env_face ^= 1;
+      if (psg->env_hold) psg->env_pause = 1;
+      psg->env_ptr = psg->env_face ? 0 : 0x1f;       
+    }
+    else
+    {
+      psg->env_pause = 1;
+      psg->env_ptr = 0;
+    }
+  }
+}
+
+/* The noise counter has reached its period */
+static inline void
+noise_step (PSG * psg)
 {
+  psg->noise_scaler ^= 1;
+  if (psg->noise_scaler) 
+  { 
+    if (psg->noise_seed & 1)
+      psg->noise_seed ^= 0x24000;
+    psg->noise_seed >>= 1;
+  }
+}
 
+/* Work out what each channel puts out from where the counters are */
+static inline void
+update_channels (PSG * psg)
+{
   int i, noise;
+
+  noise = psg->noise_seed & 1;
+
+  for (i = 0; i < 3; i++)
+  {
+    if (0 < psg->freq_limit && psg->freq[i] <= psg->freq_limit) 
+    {
+      /* Mute the channel if the pitch is higher than the Nyquist frequency at the current sample rate, 
+       * to prevent aliased or broken tones from being generated. Of course, this logic doesn't exist 
+       * on the actual chip, but practically all tones higher than the Nyquist frequency are usually 
+       * removed by a low-pass circuit somewhere, so we here halt the output. */
+      continue;
+    }
+
+    if (psg->mask & PSG_MASK_CH(i)) 
+    {
+      psg->ch_out[i] = 0;
+      continue;
+    }
+
+    if ((psg->tmask[i]||psg->edge[i]) && (psg->nmask[i]||noise))
+    {
+      if (!(psg->volume[i] & 32)) 
+        psg->ch_out[i] = (psg->voltbl[psg->volume[i] & 31] << 4);
+      else 
+        psg->ch_out[i] = (psg->voltbl[psg->env_ptr] << 4);
+    }
+    else 
+    {
+      psg->ch_out[i] = 0;
+    }
+  }
+}
+
+static inline void
+update_output (PSG * psg)
+{
+
+  int i;
   uint8_t incr;
 
   psg->base_count += psg->base_incr;
@@ -253,28 +510,7 @@ update_output (PSG * psg)
 
   if (psg->env_count >= psg->env_freq)
   {
-    if (!psg->env_pause)
-    {
-      if(psg->env_face)
-        psg->env_ptr = (psg->env_ptr + 1) & 0x3f ; 
-      else
-        psg->env_ptr = (psg->env_ptr + 0x3f) & 0x3f;
-    }
-
-    if (psg->env_ptr & 0x20) /* if carry or borrow */
-    {
-      if (psg->env_continue)
-      {
-        if (psg->env_alternate^psg->env_hold) psg->env_face ^= 1;
-        if (psg->env_hold) psg->env_pause = 1;
-        psg->env_ptr = psg->env_face ? 0 : 0x1f;       
-      }
-      else
-      {
-        psg->env_pause = 1;
-        psg->env_ptr = 0;
-      }
-    }
+    env_step (psg);
 
     if (psg->env_freq >= incr) 
       psg->env_count -= psg->env_freq;
@@ -286,20 +522,13 @@ update_output (PSG * psg)
   psg->noise_count += incr;
   if (psg->noise_count >= psg->noise_freq)
   {
-    psg->noise_scaler ^= 1;
-    if (psg->noise_scaler) 
-    { 
-      if (psg->noise_seed & 1)
-        psg->noise_seed ^= 0x24000;
-      psg->noise_seed >>= 1;
-    }
+    noise_step (psg);
     
     if (psg->noise_freq >= incr)
       psg->noise_count -= psg->noise_freq;
     else
       psg->noise_count = 0;
   }
-  noise = psg->noise_seed & 1;
 
   /* Tone */
   for (i = 0; i < 3; i++)
@@ -314,49 +543,191 @@ update_output (PSG * psg)
       else
         psg->count[i] = 0;
     }
+  }
 
-    if (0 < psg->freq_limit && psg->freq[i] <= psg->freq_limit) 
-    {
-      /* Mute the channel if the pitch is higher than the Nyquist frequency at the current sample rate, 
-       * to prevent aliased or broken tones from being generated. Of course, this logic doesn't exist 
-       * on the actual chip, but practically all tones higher than the Nyquist frequency are usually 
-       * removed by a low-pass circuit somewhere, so we here halt the output. */
-      continue;
-    }
+  update_channels (psg);
+}
 
-    if (psg->mask & PSG_MASK_CH(i)) 
-    {
-      psg->ch_out[i] = 0;
-      continue;
-    }
+static inline int16_t 
+mix_output(PSG *psg) 
+{
+  return (int16_t)(psg->ch_out[0] + psg->ch_out[1] + psg->ch_out[2]);
+}
 
-    if ((psg->tmask[i]||psg->edge[i]) && (psg->nmask[i]||noise))
+/*
+ * Put a step of delta into the band-limited output, phase / BLEP_PHASES of
+ * the way from the last sample to this one.
+ */
+static inline void
+blep_step (PSG * psg, uint32_t phase, int32_t delta)
+{
+  const int32_t *h = blep_table[phase];
+  int32_t *p = &psg->blep_buf[psg->blep_pos];
+  int k;
+
+  for (k = 0; k < BLEP_TAPS; k++)
+    p[k] += delta * h[k];
+}
+
+/* Step the band-limited output to wherever the channels now are */
+static inline void
+blep_update (PSG * psg, uint32_t phase)
+{
+  int32_t level = mix_output (psg);
+
+  if (level != psg->blep_level)
+  {
+    blep_step (psg, phase, level - psg->blep_level);
+    psg->blep_level = level;
+  }
+}
+
+/*
+ * blep_buf is read from blep_pos, and steps go in from there on, all in one
+ * piece.  When there's no longer room for a whole step after blep_pos,
+ * what's left (the only part that can be in use) is moved back down.
+ */
+static inline int16_t
+blep_read (PSG * psg)
+{
+  psg->blep_sum += psg->blep_buf[psg->blep_pos++];
+  if (psg->blep_pos == PSG_BLEP_BUF - BLEP_TAPS)
+  {
+    memcpy (psg->blep_buf, psg->blep_buf + psg->blep_pos,
+            BLEP_TAPS * sizeof (int32_t));
+    memset (psg->blep_buf + BLEP_TAPS, 0,
+            (PSG_BLEP_BUF - BLEP_TAPS) * sizeof (int32_t));
+    psg->blep_pos = 0;
+  }
+  return (int16_t) ((psg->blep_sum + (1 << (BLEP_BITS - 1))) >> BLEP_BITS);
+}
+
+/*
+ * As update_output(), but noting which tick of the sample each counter
+ * reached its period on, and stepping the output there.  The counters end
+ * up just as update_output() leaves them.
+ */
+static inline void
+update_blep (PSG * psg)
+{
+  uint32_t b = psg->base_count, c, when[5], w, phase;
+  int what[5], n = 0, i, j, x;
+  int64_t t;
+  uint8_t incr;
+
+  psg->base_count += psg->base_incr;
+  incr = (psg->base_count >> GETA_BITS);
+  psg->base_count &= (1 << GETA_BITS) - 1;
+
+  /* Registers written since the last sample change it from its start */
+  if (psg->blep_dirty)
+  {
+    psg->blep_dirty = 0;
+    update_channels (psg);
+    blep_update (psg, 0);
+  }
+
+  /* Envelope */
+  c = psg->env_count;
+  psg->env_count += incr;
+  if (psg->env_count >= psg->env_freq)
+  {
+    what[n] = 4;
+    when[n++] = (psg->env_freq > c) ? psg->env_freq - c : 0;
+
+    if (psg->env_freq >= incr) 
+      psg->env_count -= psg->env_freq;
+    else
+      psg->env_count = 0;
+  }
+
+  /* Noise */
+  c = psg->noise_count;
+  psg->noise_count += incr;
+  if (psg->noise_count >= psg->noise_freq)
+  {
+    what[n] = 3;
+    when[n++] = (psg->noise_freq > c) ? psg->noise_freq - c : 0;
+
+    if (psg->noise_freq >= incr)
+      psg->noise_count -= psg->noise_freq;
+    else
+      psg->noise_count = 0;
+  }
+
+  /* Tone */
+  for (i = 0; i < 3; i++)
+  {
+    c = psg->count[i];
+    psg->count[i] += incr;
+    if (psg->count[i] >= psg->freq[i])
     {
-      if (!(psg->volume[i] & 32)) 
-        psg->ch_out[i] = (psg->voltbl[psg->volume[i] & 31] << 4);
-      else 
-        psg->ch_out[i] = (psg->voltbl[psg->env_ptr] << 4);
+      what[n] = i;
+      when[n++] = (psg->freq[i] > c) ? psg->freq[i] - c : 0;
+
+      if (psg->freq[i] >= incr) 
+        psg->count[i] -= psg->freq[i];
+      else
+        psg->count[i] = 0;
     }
-    else 
+  }
+
+  /* Take them in the order they happened */
+  for (i = 1; i < n; i++)
+  {
+    w = when[i];
+    x = what[i];
+    for (j = i; j && when[j - 1] > w; j--)
     {
-      psg->ch_out[i] = 0;
+      when[j] = when[j - 1];
+      what[j] = what[j - 1];
     }
+    when[j] = w;
+    what[j] = x;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    if (what[i] == 4)
+      env_step (psg);
+    else if (what[i] == 3)
+      noise_step (psg);
+    else
+      psg->edge[what[i]] = !psg->edge[what[i]];
+
+    /* Tick k of the sample is (k << GETA_BITS) - b after the last one */
+    t = ((int64_t) when[i] << GETA_BITS) - b;
+    phase = (t <= 0) ? 0 : (uint32_t) (((uint64_t) t * BLEP_PHASES
+                                        + psg->base_incr / 2) / psg->base_incr);
+
+    update_channels (psg);
+    blep_update (psg, phase);
   }
 }
 
-static inline int16_t 
-mix_output(PSG *psg) 
+/* A sample at low quality or band-limited */
+static inline int16_t
+calc_sample (PSG * psg)
 {
-  return (int16_t)(psg->ch_out[0] + psg->ch_out[1] + psg->ch_out[2]);
+  if (psg->quality == PSG_QUALITY_BLEP)
+  {
+    update_blep (psg);
+    psg->out = blep_read (psg);
+  }
+  else
+  {
+    update_output (psg);
+    psg->out = mix_output (psg);
+  }
+  return (int16_t) psg->out;
 }
 
 int16_t
 PSG_calc (PSG * psg)
 {
-  if (!psg->quality) 
+  if (psg->quality != PSG_QUALITY_HIGH) 
   {
-    update_output(psg);
-    psg->out = mix_output(psg);
+    calc_sample(psg);
   }
   else
   {
@@ -373,6 +744,255 @@ PSG_calc (PSG * psg)
   return psg->out;
 }
 
+/*
+ * Block synthesis.  Between edges nothing about the output changes: the
+ * tone, noise and envelope counters only count up, and every sample is the
+ * same as the last.  So rather than stepping each sample, find the next
+ * sample at which a counter that can be heard reaches its period, advance
+ * everything to it in one go, and fill the samples up to it with the
+ * current output.  Only the sample with the edge is run through
+ * update_output(), which keeps the result identical to calling PSG_calc()
+ * n times.
+ *
+ * The counters advance by floor(base_count / 2^GETA_BITS) each sample, so
+ * over k samples they advance by floor((base_count + k * base_incr) /
+ * 2^GETA_BITS) in total, which is what lets a run be skipped at once.
+ * Counters that can't be heard (the noise when no channel mixes it in, a
+ * channel's tone when it is off or silent, the envelope when no channel
+ * uses it) are carried along through a run rather than ending it.
+ */
+
+/*
+ * Samples after the one at base count b before count reaches period.  inv
+ * is 1 / base_incr, to get close without a division; the answer is then
+ * made exact.
+ */
+static inline uint32_t
+run_length (PSG * psg, double inv, uint32_t b, uint32_t count, uint32_t period)
+{
+  uint64_t need, k;
+
+  if (count >= period)
+    return 0;
+  if (!psg->base_incr)
+    return UINT32_MAX;
+
+  /* first k with b + k * base_incr >= (period - count) << GETA_BITS */
+  need = ((uint64_t)(period - count) << GETA_BITS) - b;
+  k = (uint64_t)((double)need * inv);
+  while (k * psg->base_incr < need)
+    k++;
+  while (k && (k - 1) * psg->base_incr >= need)
+    k--;
+  return (k - 1 > UINT32_MAX) ? UINT32_MAX : (uint32_t)(k - 1);
+}
+
+/*
+ * Advance a counter (of width wrap + 1) k samples, exactly as update_output()
+ * would, and return how many times it reached its period.  incr is what
+ * all the counters advance by over the k samples.
+ */
+static uint32_t
+skip_counter (PSG * psg, uint32_t * count, uint32_t period, uint32_t wrap,
+              uint32_t k, uint32_t incr)
+{
+  uint32_t b = psg->base_count, c = *count, edges = 0;
+
+  /* Usually it doesn't get there */
+  if (c + incr < period)
+  {
+    *count = c + incr;
+    return 0;
+  }
+
+  /*
+   * If it can never gain more than a period in a sample, every time it
+   * gets there it loses exactly one period, so it's just a division.
+   */
+  if ((c < period) && (period > (psg->base_incr >> GETA_BITS)))
+  {
+    c += incr;
+    *count = c % period;
+    return c / period;
+  }
+
+  /* Otherwise just step it; this is only for counters that can't be heard */
+  while (k--)
+  {
+    b += psg->base_incr;
+    incr = (uint8_t)(b >> GETA_BITS);
+    b &= (1 << GETA_BITS) - 1;
+    c = (c + incr) & wrap;
+    if (c >= period)
+    {
+      if (period >= incr)
+        c -= period;
+      else
+        c = 0;
+      edges++;
+    }
+  }
+
+  *count = c;
+  return edges;
+}
+
+static void
+skip_samples (PSG * psg, uint32_t k)
+{
+  uint32_t c, edges, incr;
+  uint64_t t;
+  int i;
+
+  t = psg->base_count + (uint64_t)k * psg->base_incr;
+  incr = (uint32_t)(t >> GETA_BITS);
+
+  c = psg->env_count;
+  edges = skip_counter (psg, &c, psg->env_freq, 0xFFFFFFFF, k, incr);
+  psg->env_count = c;
+  while (edges--)
+    env_step (psg);
+
+  c = psg->noise_count;
+  edges = skip_counter (psg, &c, psg->noise_freq, 0xFF, k, incr);
+  psg->noise_count = (uint8_t) c;
+  while (edges--)
+    noise_step (psg);
+
+  for (i = 0; i < 3; i++)
+  {
+    c = psg->count[i];
+    edges = skip_counter (psg, &c, psg->freq[i], 0xFFFF, k, incr);
+    psg->count[i] = (uint16_t) c;
+    psg->edge[i] ^= edges & 1;
+  }
+
+  psg->base_count = (uint32_t)t & ((1 << GETA_BITS) - 1);
+}
+
+/* Counter x (0-2 the tones, 3 the noise, 4 the envelope) and its period */
+static inline uint32_t
+counter (PSG * psg, int x, uint32_t * period)
+{
+  if (x < 3)
+  {
+    *period = psg->freq[x];
+    return psg->count[x];
+  }
+  if (x == 3)
+  {
+    *period = psg->noise_freq;
+    return psg->noise_count;
+  }
+  *period = psg->env_freq;
+  return psg->env_count;
+}
+
+void
+PSG_calcBlock (PSG * psg, int16_t * out, size_t n)
+{
+  uint32_t count, period, r;
+  size_t i, j, run, next[5];
+  int x, heard[5];
+  int16_t v;
+  double inv;
+
+  if (psg->quality == PSG_QUALITY_HIGH)
+  {
+    for (i = 0; i < n; i++)
+      out[i] = PSG_calc (psg);
+    return;
+  }
+
+  inv = psg->base_incr ? 1.0 / psg->base_incr : 0;
+
+  /* Which counters' edges can change the output? */
+  heard[3] = heard[4] = 0;
+  for (x = 0; x < 3; x++)
+  {
+    int silent;
+
+    /* A tone above the Nyquist frequency holds the channel where it is */
+    if (psg->freq_limit && psg->freq[x] <= psg->freq_limit)
+    {
+      heard[x] = 0;
+      continue;
+    }
+
+    silent = (psg->mask & PSG_MASK_CH(x)) ||
+                 (!(psg->volume[x] & 32) && !psg->voltbl[psg->volume[x] & 31]);
+
+    heard[x] = !silent && !psg->tmask[x];
+    if (!silent && !psg->nmask[x])
+      heard[3] = 1;
+    if (!(psg->mask & PSG_MASK_CH(x)) && (psg->volume[x] & 32))
+      heard[4] = 1;
+  }
+
+  /*
+   * With a counter that can be heard reaching its period every few samples
+   * anyway (fast noise, mostly), there are no runs worth having.
+   */
+  for (x = 0; x < 5; x++)
+  {
+    counter (psg, x, &period);
+    if (heard[x] && (period < 4 * ((psg->base_incr >> GETA_BITS) + 1)))
+    {
+      for (i = 0; i < n; i++)
+        out[i] = calc_sample (psg);
+      return;
+    }
+  }
+
+  /*
+   * next[x] is the sample at which counter x next reaches its period.  It
+   * only has to be worked out again after it has.  Registers may have
+   * changed since the last sample, so the first is always stepped.
+   */
+  for (x = 0; x < 5; x++)
+    next[x] = 0;
+
+  i = 0;
+  while (i < n)
+  {
+    v = out[i] = calc_sample (psg);
+
+    run = n - i - 1;
+    for (x = 0; x < 5; x++)
+    {
+      if (!heard[x])
+        continue;
+      if (next[x] == i)
+      {
+        count = counter (psg, x, &period);
+        r = run_length (psg, inv, psg->base_count, count, period);
+        next[x] = (r > n) ? n : i + 1 + r;
+      }
+      if (next[x] - i - 1 < run)
+        run = next[x] - i - 1;
+    }
+    i++;
+
+    /* A short run is quicker stepped */
+    if (run < 4)
+    {
+      for (j = 0; j < run; j++)
+        out[i++] = calc_sample (psg);
+      continue;
+    }
+
+    /* Band-limited, the output is still settling from the last step */
+    skip_samples (psg, (uint32_t)run);
+    if (psg->quality == PSG_QUALITY_BLEP)
+      for (j = 0; j < run; j++)
+        out[i + j] = psg->out = blep_read (psg);
+    else
+      for (j = 0; j < run; j++)
+        out[i + j] = v;
+    i += run;
+  }
+}
+
 void
 PSG_writeReg (PSG * psg, uint32_t reg, uint32_t val)
 {
@@ -383,6 +1003,7 @@ PSG_writeReg (PSG * psg, uint32_t reg, uint32_t val)
   val &= regmsk[reg];
 
   psg->reg[reg] = (uint8_t) val;
+  psg->blep_dirty = 1;
 
   switch (reg)
   {
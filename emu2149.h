@@ -23,10 +23,18 @@
 #ifndef _EMU2149_H_
 #define _EMU2149_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define PSG_MASK_CH(x) (1<<(x))
 
+/* PSG_setQuality() */
+#define PSG_QUALITY_LOW 0   /* one step per sample (aliases) */
+#define PSG_QUALITY_HIGH 1  /* oversampled (slow) */
+#define PSG_QUALITY_BLEP 2  /* band-limited steps (as fast as low) */
+
+#define PSG_BLEP_BUF 64
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -85,6 +93,13 @@ extern "C"
     /* output of channels */
     int16_t ch_out[3];
 
+    /* band-limited steps, waiting to be added into the output */
+    int32_t blep_buf[PSG_BLEP_BUF];
+    int32_t blep_sum;
+    int32_t blep_level;
+    uint8_t blep_pos;
+    uint8_t blep_dirty;
+
   } PSG;
 
   void PSG_setQuality (PSG * psg, uint8_t q);
@@ -99,6 +114,7 @@ extern "C"
   uint8_t PSG_readReg (PSG * psg, uint32_t reg);
   uint8_t PSG_readIO (PSG * psg);
   int16_t PSG_calc (PSG *);
+  void PSG_calcBlock (PSG *, int16_t *out, size_t n);
   void PSG_setVolumeMode (PSG * psg, int type);
   uint32_t PSG_setMask (PSG *, uint32_t mask);
   uint32_t PSG_toggleMask (PSG *, uint32_t mask);
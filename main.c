@@ -69,7 +69,7 @@
 /* Chipset includes */
 #include "tms9918.h"
 #include "tms_util.h"
-#include "emu2149.h"
+#include "psgio.h"
 #include "z80.h"
 
 /* FDC include */
@@ -81,11 +81,41 @@
 /* Alterable filenames */
 #include "paths.h"
 
+#ifndef __MSDOS__
+/* Video capture */
+#include "capture.h"
+
+/* Shared-memory frame export */
+#include "shmfb.h"
+
+/* Remote display */
+#include "rfb.h"
+
+/* Terminal display */
+#include "term.h"
+
+/* VDP debug view */
+#include "vdpview.h"
+
+/* Video pipeline */
+#include "video.h"
+
+/* Sound synthesis */
+#include "emu2149.h"
+#include "sound.h"
+
+/* Sound recording */
+#include "soundlog.h"
+#endif
+
 /*
  * Forward declarations.
  */
 static void reinit_cpu(void);
 void fatal_diag(int, char *);
+#ifndef __MSDOS__
+static void present_frame(void);
+#endif
 
 /* Extern declaration */
 void cpustatus (z80 *cpu);
@@ -128,9 +158,12 @@ int romsize;
  */
 z80 cpu;
 VrEmuTms9918 *vdp;
-PSG *psg;
 int ctrlreg;
 
+/* CPU and PSG clocks, Hz */
+#define CPU_CLOCK 3579545
+#define PSG_CLOCK 1789772
+
 int gotmodem;
 unsigned dog_speed;
 
@@ -151,6 +184,43 @@ uint8_t joybyte;
 int dojoy;
 void add_gamecontroller(int joystick_index);
 
+/* Window scaling: 'n'earest, 'l'inear or 'i'nteger (-s switch) */
+int scale_mode;
+
+/* Window was exposed or resized: present even an unchanged frame. */
+int force_present;
+int window_hidden;
+
+/* -v file: capture video, -A: and the sound with it */
+char *capture_name;
+int capture_sound;
+
+/* -M name: publish each new frame in shared memory for external viewers */
+char *export_name;
+
+/* -R port: serve the screen (and take keys) over VNC on 127.0.0.1:port */
+char *rfb_port;
+
+/* -t: show text screens on the terminal instead of in a window */
+int terminal_video;
+
+/* -c s and/or b: CRT scanlines and phosphor blur */
+int crt_scanlines, crt_blur;
+
+/* -V v|a|i|b: present with vsync, adaptive, immediately, or at vblank */
+int present_mode = 'i';
+
+#ifndef __MSDOS__
+/* -q l|h|b: sound at low quality, oversampled, or band-limited */
+int sound_quality = PSG_QUALITY_LOW;
+
+/* -m: no sound at all */
+int no_sound;
+
+/* -w file: record the sound to a .wav; -g file: log the PSG to a .vgm */
+char *wav_name, *vgm_name;
+#endif
+
 FILE *lpt;
 uint8_t lpt_data;
 
@@ -165,9 +235,6 @@ int ttyup;
 #else
 /*
  * SDL2 structure pointers.
- *
- * display is a dynamically allocated offscreen buffer used for rendering the
- * VDP data, or the generated NTSC noise.
  */
 SDL_Window *screen;
 SDL_Renderer *renderer;
@@ -177,7 +244,7 @@ SDL_AudioSpec audio_spec;
 SDL_GameController *pad;
 SDL_Joystick *joystick;
 
-uint32_t *display;
+VIDEO *video;
 #endif
 
 int psg_calc_flag = 0;
@@ -314,7 +381,7 @@ void int_prio_enc_alt(int EI, int interrupts, int *GS, int *Q0,
                GS, Q0, Q1, Q2, EO);
 }
 
-/* fed into PSG's PORTB via PSG_writeReg,
+/* fed into PSG's PORTB via psgio_write,
  since NABU never writes to PORTB, this should be safe */
 uint8_t psg_portb = 0;
 
@@ -368,7 +435,7 @@ void update_interrupts()
   int_prio_enc_alt(0, int_prio, &GS, &Q0, &Q1, &Q2, &EO);
   psg_portb &= 0xf0;
   psg_portb |= EO | (Q0 << 1) | (Q1 << 2) | (Q2 << 3);
-  PSG_writeReg(psg, 15, psg_portb);
+  psgio_write(15, psg_portb);
   /*
   A0 - D7
   A1 - D2
@@ -404,6 +471,82 @@ uint8_t keyboard_buffer_get()
   return 255;
 }
 
+#ifndef __MSDOS__
+/*
+ * Input latency: the time from a key event (by SDL's own timestamp) to the
+ * first frame presented that was drawn after the guest read that key from
+ * the keyboard port.  One key is followed at a time; F8 or exiting shows
+ * the figures.
+ */
+static int latency_following;  /* a key is being followed */
+static Uint32 latency_start;   /* when it was pressed, SDL_GetTicks() time */
+static uint8_t latency_slot;   /* where it went in the keyboard buffer */
+static int latency_read;       /* and the guest has read it */
+static unsigned latency_frame; /* frames emulated so far */
+static unsigned latency_read_frame; /* the one during which it was read */
+static unsigned long latency_count;
+static double latency_total, latency_min, latency_max;
+
+/*
+ * A key event, pressed at when, put its first byte in keyboard_buffer[slot].
+ * A key still followed after LATENCY_GIVE_UP ms (never read, or read while
+ * the window was hidden) is given up on, and this one followed instead.
+ */
+#define LATENCY_GIVE_UP 1000
+static void latency_key(uint8_t slot, Uint32 when)
+{
+  if (latency_following && ((Uint32)(when - latency_start) < LATENCY_GIVE_UP))
+    return;
+  latency_following = 1;
+  latency_start = when;
+  latency_slot = slot;
+  latency_read = 0;
+}
+
+/* The guest has just read keyboard_buffer[slot]. */
+static void latency_port_read(uint8_t slot)
+{
+  if (latency_following && !latency_read && (slot == latency_slot))
+  {
+    latency_read = 1;
+    latency_read_frame = latency_frame;
+  }
+}
+
+/*
+ * A frame has gone to the screen, or was already there unchanged, drawn
+ * behind frames before the one being emulated (1 with -T, where the render
+ * thread is a frame behind).
+ */
+static void latency_presented(int behind)
+{
+  double ms;
+
+  if (!latency_read || ((int)(latency_frame - behind - latency_read_frame) < 0))
+    return;
+
+  ms = (Uint32)(SDL_GetTicks() - latency_start);
+  if (!latency_count || (ms < latency_min))
+    latency_min = ms;
+  if (!latency_count || (ms > latency_max))
+    latency_max = ms;
+  latency_total += ms;
+  latency_count++;
+  latency_following = 0;
+  latency_read = 0;
+}
+
+static void latency_report(void)
+{
+  if (latency_count)
+    printf("Input to present: %lu keys, %.1f ms average, %.1f-%.1f ms\n",
+           latency_count, latency_total / latency_count, latency_min,
+           latency_max);
+  else
+    printf("Input to present: no keys measured yet\n");
+}
+#endif
+
 /* used for latching PSG's register address */
 uint8_t psg_reg_address = 0x00;
 
@@ -416,7 +559,7 @@ uint8_t port_read(z80 *mycpu, uint8_t port)
   switch (port)
   {
   case 0x40: /* read register from PSG */
-    t = PSG_readReg(psg, psg_reg_address);
+    t = psgio_read(psg_reg_address);
     return t;
   case 0x41:
     fatal_diag(-1, "IO read from 0x41, this shouldn't happen, exiting!");
@@ -434,6 +577,10 @@ uint8_t port_read(z80 *mycpu, uint8_t port)
     }
     return 0;
   case 0x90: /* Not sure if this is the right action */
+#ifndef __MSDOS__
+    if (!keyboard_buffer_empty())
+      latency_port_read(keyboard_buffer_read_ptr);
+#endif
     t = keyboard_buffer_get();
     keybdint = 0;
     update_interrupts();
@@ -471,7 +618,7 @@ void port_write(z80 *mycpu, uint8_t port, uint8_t val)
     ctrlreg = val;
     return;
   case 0x40: /* write data to PSG */
-    psg_reg7 = PSG_readReg(psg, 7);
+    psg_reg7 = psgio_read(7);
     if (psg_reg_address == 0x0E)
     {
       if (!(psg_reg7 & 0x40))
@@ -497,7 +644,11 @@ void port_write(z80 *mycpu, uint8_t port, uint8_t val)
         diag_printf("psg_reg7 = %02X\r\n", psg_reg7);
       }
     }
-    PSG_writeReg(psg, psg_reg_address, val);
+    psgio_write(psg_reg_address, val);
+#ifndef __MSDOS__
+    sound_write((uint32_t)cpu.cyc, psg_reg_address, val);
+    soundlog_vgm_write((uint32_t)cpu.cyc, psg_reg_address, val);
+#endif
     return;
   case 0x41: /* write address to PSG */
     if (val > 0x1f)
@@ -513,9 +664,16 @@ void port_write(z80 *mycpu, uint8_t port, uint8_t val)
     }
     return;
   case 0xA0:
+#ifndef __MSDOS__
+    video_flush(video);
+#endif
     vrEmuTms9918WriteData(vdp, val);
     return;
   case 0xA1:
+#ifndef __MSDOS__
+    if (val & 0x80) /* maybe a register */
+      video_flush(video);
+#endif
     vrEmuTms9918WriteAddr(vdp, val);
     return;
   case 0xB0:
@@ -653,6 +811,65 @@ void keyboard_poll(void)
  if (k==0x4400) death_flag=1;
 }
 #else
+/* Hotkey recordings without a name given go to marduk-001.wav and so on */
+static char *sound_log_name(char *buf, const char *ext)
+{
+  FILE *file;
+  int i;
+
+  for (i = 1; i < 1000; i++)
+  {
+    sprintf(buf, "marduk-%03d.%s", i, ext);
+    file = fopen(buf, "rb");
+    if (!file)
+      return buf;
+    fclose(file);
+  }
+  return NULL;
+}
+
+/* F5: start or stop recording the sound to a .wav */
+void toggle_wav(char *name)
+{
+  char buf[32];
+
+  if (soundlog_wav_active())
+  {
+    soundlog_wav_close();
+    return;
+  }
+  if (!audio_device)
+  {
+    printf("No sound to record\n");
+    return;
+  }
+  if (!name)
+    name = sound_log_name(buf, "wav");
+  if (name && !soundlog_wav_open(name, 44100))
+    printf("Recording sound to %s\n", name);
+}
+
+/* Shift-F5: start or stop logging the PSG to a .vgm */
+void toggle_vgm(char *name)
+{
+  char buf[32];
+  uint8_t regs[14];
+  int r;
+
+  if (soundlog_vgm_active())
+  {
+    soundlog_vgm_close((uint32_t)cpu.cyc);
+    return;
+  }
+  if (!name)
+    name = sound_log_name(buf, "vgm");
+  for (r = 0; r < 14; r++)
+    regs[r] = psgio_read(r);
+  if (name && !soundlog_vgm_open(name, CPU_CLOCK, PSG_CLOCK,
+                                 (uint32_t)cpu.cyc, regs))
+    printf("Logging the PSG to %s\n", name);
+}
+
 void add_gamecontroller(int joystick_index)
 {
     if (joystick != NULL)
@@ -688,9 +905,13 @@ void send_joybyte() {
 void keyboard_poll(void)
 {
   SDL_Event event;
+  uint8_t key_slot;
+
   /* eat up all events */
   while (SDL_PollEvent(&event))
   {
+    key_slot = keyboard_buffer_write_ptr;
+
     /* These are irrelevant if the keyboard is emulating the joystick */
     if (!keyjoy)
     {
@@ -1040,12 +1261,21 @@ void keyboard_poll(void)
          if (SDL_GetModState() & KMOD_ALT)
            death_flag = 1;
          break;
+        case SDLK_F5: /* F5 - record sound, Shift-F5 - log PSG */
+         if (SDL_GetModState() & KMOD_SHIFT)
+           toggle_vgm(NULL);
+         else
+           toggle_wav(NULL);
+         break;
         case SDLK_F6: /* F6 - enable keyboard joystick */
          keyjoy=!keyjoy;
          joybyte=0;
          diag_printf ("Arrows and Space are %s\n",
                       keyjoy?"JOYSTICK":"KEYBOARD");
          break;
+        case SDLK_F8: /* F8 - input latency so far */
+         latency_report();
+         break;
         case SDLK_F7: /* F7 - trace (later will be enter debugger) */
          trace=!trace;
          diag_printf ("CPU Trace is now %s\n", trace?"ON":"OFF");
@@ -1116,14 +1346,132 @@ void keyboard_poll(void)
         case SDLK_F10: /* F10 - also exit */
          death_flag = 1;
          break;
+        case SDLK_F12: /* F12 - VDP debug view */
+         vdpview_toggle();
+         break;
        }
       break;
      case SDL_QUIT: /* someone killed our window */
       death_flag = 1;
       break;
+     case SDL_WINDOWEVENT:
+      if (vdpview_event(&event))
+        break;
+      switch (event.window.event)
+      {
+       case SDL_WINDOWEVENT_CLOSE: /* with the debug view open, no SDL_QUIT */
+        death_flag = 1;
+        break;
+       case SDL_WINDOWEVENT_HIDDEN: /* no point drawing what can't be seen */
+       case SDL_WINDOWEVENT_MINIMIZED:
+        window_hidden = 1;
+        break;
+       case SDL_WINDOWEVENT_SHOWN: /* repaint, even if the frame hasn't changed */
+       case SDL_WINDOWEVENT_RESTORED:
+       case SDL_WINDOWEVENT_EXPOSED:
+       case SDL_WINDOWEVENT_SIZE_CHANGED:
+        window_hidden = 0;
+        force_present = 1;
+        break;
+      }
+      break;
     }
+
+    if ((event.type == SDL_KEYDOWN) && (keyboard_buffer_write_ptr != key_slot))
+      latency_key(key_slot, event.key.timestamp);
   }
 }
+
+/*
+ * Keys from a remote display viewer or the terminal, as X11 keysyms.  These are already
+ * shifted, so only Ctrl needs working out here.
+ */
+static void remote_key(uint32_t sym, int down)
+{
+  static const struct
+  {
+    uint32_t sym;
+    uint8_t make;
+    uint8_t joy;
+  } special[] = {
+    { 0xFF51, 0xE1, 0x01 }, /* Left */
+    { 0xFF52, 0xE2, 0x08 }, /* Up */
+    { 0xFF53, 0xE0, 0x04 }, /* Right */
+    { 0xFF54, 0xE3, 0x02 }, /* Down */
+    { 0xFF55, 0xE5, 0 },    /* Page Up: « */
+    { 0xFF56, 0xE4, 0 },    /* Page Down: » */
+    { 0xFF63, 0xE7, 0 },    /* Insert: YES */
+    { 0xFFFF, 0xE6, 0 },    /* Delete: NO */
+    { 0xFF13, 0xE9, 0 },    /* Pause */
+    { 0xFF57, 0xEA, 0 },    /* End */
+    { 0xFFE9, 0xE8, 0 },    /* Alt for Sym */
+    { 0xFFEA, 0xE8, 0 },
+    { 0x0020, 0, 0x10 },    /* Space, when it's the fire button */
+  };
+  static int ctrl;
+  int i;
+
+  if ((sym == 0xFFE3) || (sym == 0xFFE4))
+  {
+    ctrl = down;
+    return;
+  }
+
+  for (i = 0; i < (int)(sizeof(special) / sizeof(*special)); i++)
+  {
+    if (special[i].sym != sym)
+      continue;
+    if (keyjoy && special[i].joy)
+    {
+      if (down)
+        joybyte |= special[i].joy;
+      else
+        joybyte &= ~special[i].joy;
+      send_joybyte();
+      return;
+    }
+    if (special[i].make)
+    {
+      keyboard_buffer_put(down ? special[i].make : special[i].make + 0x10);
+      return;
+    }
+  }
+
+  if (!down)
+    return;
+
+  switch (sym)
+  {
+    case 0xFF08: /* BackSpace */
+      keyboard_buffer_put(0x7F);
+      return;
+    case 0xFF09: /* Tab */
+      keyboard_buffer_put(0x09);
+      return;
+    case 0xFF0D: /* Return */
+    case 0xFF8D: /* keypad Enter */
+      keyboard_buffer_put(0x0D);
+      return;
+    case 0xFF1B: /* Escape */
+      keyboard_buffer_put(0x1B);
+      return;
+  }
+
+  if ((sym < 0x20) || (sym > 0x7E))
+    return;
+  if (ctrl)
+  {
+    if ((sym == '2') || (sym == '@'))
+      sym = 0xFF; /* interpreted as 0x00 when read */
+    else if ((sym == '6') || (sym == '^'))
+      sym = 0x1E;
+    else if (sym == '-')
+      sym = 0x1F;
+    else if (((sym >= 'A') && (sym <= '_')) || ((sym >= 'a') && (sym <= 'z')))
+      sym &= 0x1F;
+  }
+  keyboard_buffer_put(sym);
+}
 #endif
 
 /*
@@ -1183,6 +1531,31 @@ void every_scanline(void)
   throttle();
 }
 
+#if defined(__MSDOS__)&&defined(ALLOW_NTSC_NOISE)
+/*
+ * NTSC noise.  Rather than calling rand() for every pixel, a block of noise
+ * is made once at startup, and each line is a copy of 320 pixels of it from
+ * a random place.  It only has black ($10) and white ($1F) to work with.
+ * (The SDL version's is in video.c.)
+ */
+#define NOISE_ATLAS 16384
+
+static uint8_t noise8[NOISE_ATLAS + 320];
+
+void init_noise(void)
+{
+  int x;
+
+  for (x = 0; x < NOISE_ATLAS + 320; x++)
+    noise8[x] = (rand() & 0xFF) ? 0x1F : 0x10;
+}
+
+static int noise_offset(void)
+{
+  return rand() % NOISE_ATLAS;
+}
+#endif
+
 /*
  * Exactly what it says on the tin.
  * Call the TMS9918 emulator to generate the next scanline into the offscreen.
@@ -1226,16 +1599,7 @@ void render_scanline(int line)
    * noise).
    */
   if (!(ctrlreg & 0x02))
-  {
-    uint32_t c;
-
-    r = line * 320;
-    for (x = 0; x < 320; x++)
-    {
-      c = rand() & 0xFF;
-      display[r + x] = c?0x1F:0x10;
-    }
-  }
+    memcpy(&display[line * 320], &noise8[noise_offset()], 320);
 #endif
 
   /*
@@ -1249,182 +1613,366 @@ void render_scanline(int line)
   display[63647]=(ctrlreg&0x10)?0x1C:0x10; /* Red LED */
   display[63649]=(ctrlreg&0x08)?0x1A:0x10; /* Green LED */
 }
-#else /* The full 640x480 SDL version */
+#else /* The SDL version, native 320x240, scaled by the renderer */
+/*
+ * The frame is drawn by the video pipeline (video.c), into a frame of its
+ * own; what's here puts it on the screen and hands it to everything else
+ * that wants it.
+ *
+ * With -i the frame is kept as 8-bit palette indexes, a quarter the size
+ * of the ARGB frame, and only looked up through argb_palette when it is
+ * handed to SDL in next_frame().  With -T it is drawn on a thread of its
+ * own, a frame behind.
+ */
+uint32_t argb_palette[256];
+int indexed_video;
+int threaded_video;
+
+/*
+ * The LEDs, packed as ctrlreg bits 3-5, disk lights << 8 and $400 for the
+ * keyboard joystick.
+ */
+static int get_lights(void)
+{
+  return (ctrlreg & 0x38) | ((disksys_light & 0x03) << 8) | (keyjoy ? 0x400 : 0);
+}
+
+/*
+ * The overlay laid over the bottom border at present time.  It is only
+ * redrawn when one of the LEDs changes, and this returns whether they had.
+ */
+SDL_Texture *overlay;
+
+static int update_overlay(void)
+{
+  const uint32_t *px;
+
+  px = video_overlay(video, get_lights());
+  if (!px)
+    return 0;
+
+  SDL_UpdateTexture(overlay, NULL, px, VIDEO_W * sizeof(uint32_t));
+  return 1;
+}
+
+/*
+ * Frame skipping.  -f n draws one frame in every n+1; -f a only skips when
+ * the emulation has fallen more than a frame behind real time, and never
+ * more than MAX_AUTO_SKIP in a row.  A skipped frame still runs the status
+ * side of the VDP, so collisions, the 5th sprite flag and the interrupt are
+ * exactly as they would be, but nothing is drawn, uploaded or presented.
+ * While the window is hidden or minimized, nothing is drawn at all.
+ */
+#define MAX_AUTO_SKIP 4
+
+int frame_skip;        /* -f n, or -1 for automatic */
+static int skip_frame, frames_skipped;
+static Uint64 frame_clock;
+static Sint64 frame_debt, frame_tick;
+
+/* Decide whether the frame about to start will be drawn. */
+static void plan_frame(void)
+{
+  Uint64 now;
+
+  now = SDL_GetPerformanceCounter();
+  frame_tick = (Sint64)(SDL_GetPerformanceFrequency() / 60);
+
+  /*
+   * Keep a running total of how late we are.  Up to a frame early can
+   * offset later jitter, and a long stall (e.g. the window being dragged)
+   * is forgiven rather than made up with seconds of skipping.
+   */
+  if (frame_clock)
+    frame_debt += (Sint64)(now - frame_clock) - frame_tick;
+  frame_clock = now;
+  if (frame_debt < -frame_tick)
+    frame_debt = -frame_tick;
+  if (frame_debt > frame_tick * 8)
+    frame_debt = frame_tick * 8;
+
+  if (frame_skip < 0)
+    skip_frame = (frame_debt > frame_tick) && (frames_skipped < MAX_AUTO_SKIP);
+  else
+    skip_frame = frames_skipped < frame_skip;
+
+  if (skip_frame)
+    frames_skipped++;
+  else
+    frames_skipped = 0;
+
+  /* Nobody is looking, unless it's through a capture, export or viewer */
+  if (window_hidden && !capture_name && !export_name && !rfb_port)
+    skip_frame = 1;
+}
+
 void render_scanline(int line)
 {
-  int x;
-  int t;
-  uint32_t r;
-  uint32_t bg;
-  uint8_t a_scanline[256];
-  uint32_t g_scanline[320];
   if (line > 239)
     return;
 
   /*
-   * To note:
-   *
-   * The background color is register 7, AND 0x0F.
-   * The border is 64 pels left and right, 48 top and bottom, thus 512x384 in a
-   * 640x480 window.
-   *
-   * The palette is stored RGBA, but we use ARGB; accomodate it.
+   * -V b: the last active line is drawn ahead of its status, so the frame
+   * can be shown, and anything typed meanwhile read, before the VDP flags
+   * the vblank.  (With -T the frame drawn is a frame behind, so it is shown
+   * at the end of the frame as usual.)
    */
-  bg = 0xFF000000 | (vrEmuTms9918Palette[vrEmuTms9918RegValue(vdp, 7) & 0x0F] >> 8);
-  for (x = 0; x < 320; x++)
-    g_scanline[x] = bg;
-  if ((line >= 24) && (line < 216))
+  if ((line == 215) && (present_mode == 'b') && !threaded_video)
   {
-    vrEmuTms9918ScanLine(vdp, line - 24, a_scanline);
-    for (x = 0; x < 256; x++)
-      g_scanline[x + 32] = vrEmuTms9918Palette[a_scanline[x]] >> 8;
+    video_scanline(video, line, ctrlreg & 0x02);
+    video_flush(video); /* lines put off till the end of the frame */
+    if (!window_hidden)
+      present_frame();
+    keyboard_poll();
+    vrEmuTms9918ScanLineStatus(vdp, line - 24);
+    return;
   }
 
-  /* Double-scan. */
-  r = line * 1280;
-  for (x = 0; x < 320; x++)
-  {
-    display[r + (x << 1)] = display[r + 1 + (x << 1)] =
-        display[r + 640 + (x << 1)] = display[r + 641 + (x << 1)] = g_scanline[x];
-  }
+  /* The sprite flags and interrupt have to be right on time, always. */
+  if ((line >= 24) && (line < 216))
+    vrEmuTms9918ScanLineStatus(vdp, line - 24);
 
-  /* Apparently some third-party software flips this bit incorrectly. */
-#ifdef ALLOW_NTSC_NOISE
-  /*
-   * If the display is in "TV" mode, just spew some NTSC noise into the buffer.
-   *
-   * This actually looks pretty realistic (I grew up in the days of aerials and
-   * 3 major TV networks, and am well acquainted with the appearance of NTSC
-   * noise).
-   */
-  if (!(ctrlreg & 0x02))
+  video_scanline(video, line, ctrlreg & 0x02);
+}
+#endif
+
+/*
+ * End of frame.  Blit it out.
+ * Also for anything that needs done every 1/60 second.
+ */
+#ifdef __MSDOS__
+void next_frame(void)
+{
+  memcpy (vgamem, display, 64000);
+}
+#else
+/*
+ * Hand the finished frame to the capture (every frame, to keep its rate)
+ * and to the shared-memory export and remote display (which only care
+ * whether something in it changed).
+ */
+static void export_frame(void)
+{
+  const void *frame = video_frame(video);
+  int touched = video_touched(video);
+
+  if (capture_name)
+    capture_frame(frame);
+  if (export_name && touched)
+    shmfb_publish(frame);
+  if (rfb_port)
+    rfb_frame(frame, touched);
+}
+
+/*
+ * CRT effects (-c).  Both are done as the frame goes to the screen, so the
+ * frame itself (and anything recorded from it) stays as the VDP drew it.
+ *
+ * The phosphor blur is a 1-2-1 blend of each pixel with its neighbours
+ * along the line, done on all four channels of a pixel at once, applied to
+ * the lines uploaded anyway.
+ */
+static inline uint32_t average(uint32_t a, uint32_t b)
+{
+  return (a & b) + (((a ^ b) >> 1) & 0x7F7F7F7F);
+}
+
+static void blur_row(uint32_t *dst, const uint32_t *src)
+{
+  int x;
+
+  dst[0] = src[0];
+  for (x = 1; x < 319; x++)
+    dst[x] = average(average(src[x - 1], src[x + 1]), src[x]);
+  dst[319] = src[319];
+}
+
+/*
+ * The scanlines are a texture one pixel wide and as tall as the frame is on
+ * the screen, with the bottom third or so of each line darkened, laid over
+ * the frame by the GPU.  It only has to be remade when the scale changes.
+ * Below double size there is no room for them.
+ */
+static SDL_Texture *scanlines;
+static int scanlines_scale;
+
+static void draw_scanlines(void)
+{
+  SDL_Rect r;
+  float sx, sy;
+  int k, y;
+
+  SDL_RenderGetScale(renderer, &sx, &sy);
+  k = (int)sy;
+  if (k < 2)
+    return;
+
+  if (k != scanlines_scale)
   {
-    uint32_t c;
+    uint32_t *px;
 
-    r = line * 1280;
-    for (x = 0; x < 1280; x++)
+    if (scanlines)
+      SDL_DestroyTexture(scanlines);
+    scanlines = NULL;
+    scanlines_scale = k;
+
+    px = malloc(240 * k * sizeof(uint32_t));
+    if (!px)
+      return;
+    for (y = 0; y < 240 * k; y++)
+      px[y] = ((y % k) >= k - (k + 2) / 3) ? 0x60000000 : 0;
+
+    /* Never smear them, whatever -s says */
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+    scanlines = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                  SDL_TEXTUREACCESS_STATIC, 1, 240 * k);
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY,
+                (scale_mode == 'l') ? "linear" : "nearest");
+    if (scanlines)
     {
-      c = rand() & 0xFF;
-      display[r + x] = 0xFF000000 | (c << 16) | (c << 8) | (c);
+      SDL_SetTextureBlendMode(scanlines, SDL_BLENDMODE_BLEND);
+      SDL_UpdateTexture(scanlines, NULL, px, sizeof(uint32_t));
     }
+    free(px);
   }
-#endif
+  if (!scanlines)
+    return;
+
+  r.x = 0;
+  r.y = 0;
+  r.w = 320;
+  r.h = 240;
+  SDL_RenderCopy(renderer, scanlines, 0, &r);
+}
+
+/*
+ * Present modes (-V).  With vsync ('v') every present waits for the
+ * monitor; immediate ('i') never waits, and may tear.  Adaptive ('a') waits
+ * while the emulation is keeping up with real time and stops waiting as
+ * soon as it falls behind, rather than losing another frame to the wait.
+ * At vblank ('b') is immediate, but presents as soon as the last active
+ * line is drawn (see render_scanline) rather than at the end of the frame,
+ * then polls for input again before the VDP raises its interrupt flag, so
+ * that keys typed while the driver had the thread are still seen this frame.
+ * The bottom border goes out with the next frame.
+ */
+static void adapt_vsync(void)
+{
+  static int vsync = 1;
+  int want;
+
+  want = frame_debt <= frame_tick / 2;
+  if (want != vsync)
+  {
+    SDL_RenderSetVSync(renderer, want);
+    vsync = want;
+  }
+}
+
+static void present_frame(void)
+{
+  SDL_Rect r;
+  const uint32_t *argb;
+  int lo, hi;
 
   /*
-   * Draw the LEDs.
-   *
-   * They will appear in the bottom right corner, in the order in which
-   * they appear on the system unit.  The current code generates a sort of
-   * rounded or "chewed-out" rectangle.  Not efficient code.
+   * If no line was redrawn, the texture already holds this frame, and unless
+   * the LEDs changed or the window needs repainting there is nothing to do.
    */
-  if ((line >= 232) && (line < 236))
+  if (update_overlay())
+    force_present = 1;
+  if (!video_changed(video, &lo, &hi))
   {
-    uint32_t le[3], ri[3];
-
-    r = line * 1280;
-    
-    if (disksys_light&0x01)
-    {
-     for (t=8; t<16; t++)
-      display[r+t]=display[r+640+t]=0xFFCC0000;
-    }
-    
-    if (disksys_light&0x02)
-    {
-     for (t=24; t<32; t++)
-      display[r+t]=display[r+640+t]=0xFFCC0000;
-    }
-    
-    if (keyjoy)
+    if (!force_present)
     {
-     uint16_t c;
-     
-     /* 576-583 */
-     if (line==235)
-     {
-      for (c=576; c<584; c++)
-      {
-       display[r+c]=display[r+640+c]=0xFF333333;
-      }
-     }
-     else if (line==232)
-     {
-      display[r+579]=display[r+580]=0xFFCC0000;
-      display[r+579+640]=display[r+580+640]=0xFF333333;
-     }
-     else
-     {
-      display[r+579]=display[r+579+640]=0xFF333333;
-      display[r+580]=display[r+580+640]=0xFF333333;
-     }
-      
-     if (line==234) display[r+577]=display[r+577+640]=0xFFCC0000;
+      /*
+       * Nothing was redrawn, so what is on the screen is already this
+       * frame: a key read that changed nothing is done with here.
+       */
+      latency_presented(threaded_video);
+      return;
     }
+  }
+  else
+  {
+    r.x = 0;
+    r.y = lo;
+    r.w = VIDEO_W;
+    r.h = hi - lo + 1;
 
-    if (line == 232)
-    {
-      le[0] = display[r + 592];
-      ri[0] = display[r + 599];
-      le[1] = display[r + 608];
-      ri[1] = display[r + 615];
-      le[2] = display[r + 624];
-      ri[2] = display[r + 631];
-    }
-    else if (line == 235)
+    /*
+     * An indexed frame is looked up by the render thread with -T; without
+     * it there's no other thread to do it, so it's done here.
+     */
+    argb = video_frame_argb(video);
+    if (!argb || crt_blur)
     {
-      le[0] = display[r + 640 + 592];
-      ri[0] = display[r + 640 + 599];
-      le[1] = display[r + 640 + 608];
-      ri[1] = display[r + 640 + 615];
-      le[2] = display[r + 640 + 624];
-      ri[2] = display[r + 640 + 631];
-    }
+      /* Apply the palette and/or blur on the way into the texture. */
+      void *pixels;
+      int pitch, x, y;
+      uint32_t row[320];
 
-    for (x = 592; x < 600; x++) /* Yellow LED */
-      display[r + x] = display[r + 640 + x] = (ctrlreg & 0x20) ? 0xFFFFFF00 : 0;
-    for (x = 608; x < 616; x++) /* Red LED */
-      display[r + x] = display[r + 640 + x] = (ctrlreg & 0x10) ? 0xFFFF0000 : 0;
-    for (x = 624; x < 632; x++) /* Green LED */
-      display[r + x] = display[r + 640 + x] = (ctrlreg & 0x08) ? 0xFF00FF00 : 0;
+      if (!SDL_LockTexture(texture, &r, &pixels, &pitch))
+      {
+        for (y = 0; y < r.h; y++)
+        {
+          uint32_t *dst = (uint32_t *)((uint8_t *)pixels + y * pitch);
+          const uint32_t *src = row;
 
-    if (line == 232)
-    {
-      display[r + 592] = le[0];
-      display[r + 599] = ri[0];
-      display[r + 608] = le[1];
-      display[r + 615] = ri[1];
-      display[r + 624] = le[2];
-      display[r + 631] = ri[2];
-    }
-    else if (line == 235)
-    {
-      display[r + 640 + 592] = le[0];
-      display[r + 640 + 599] = ri[0];
-      display[r + 640 + 608] = le[1];
-      display[r + 640 + 615] = ri[1];
-      display[r + 640 + 624] = le[2];
-      display[r + 640 + 631] = ri[2];
+          if (!argb)
+          {
+            const uint8_t *src8 = (const uint8_t *)video_frame(video) + (lo + y) * VIDEO_W;
+            uint32_t *to = crt_blur ? row : dst;
+
+            for (x = 0; x < 320; x++)
+              to[x] = argb_palette[src8[x]];
+          }
+          else
+            src = argb + (lo + y) * VIDEO_W;
+          if (crt_blur)
+            blur_row(dst, src);
+        }
+        SDL_UnlockTexture(texture);
+      }
     }
+    else
+      SDL_UpdateTexture(texture, &r, argb + lo * VIDEO_W,
+                        VIDEO_W * sizeof(uint32_t));
   }
+  force_present = 0;
+  SDL_RenderClear(renderer);
+  SDL_RenderCopy(renderer, texture, 0, 0);
+  if (crt_scanlines)
+    draw_scanlines();
+  r.x = 0;
+  r.y = VIDEO_OVERLAY_Y;
+  r.w = VIDEO_W;
+  r.h = VIDEO_OVERLAY_H;
+  SDL_RenderCopy(renderer, overlay, 0, &r);
+  if (present_mode == 'a')
+    adapt_vsync();
+  SDL_RenderPresent(renderer);
+  latency_presented(threaded_video);
 }
-#endif
 
-/*
- * End of frame.  Blit it out.
- * Also for anything that needs done every 1/60 second.
- */
-#ifdef __MSDOS__
-void next_frame(void)
-{
-  memcpy (vgamem, display, 64000);
-}
-#else
 void next_frame(void)
 {
-  SDL_UpdateTexture(texture, 0, display, 640 * sizeof(uint32_t));
-  SDL_RenderClear(renderer);
-  SDL_RenderCopy(renderer, texture, 0, 0);
-  SDL_RenderPresent(renderer);
+  /*
+   * With -T, this waits for the render thread to finish the last frame,
+   * which is shown, and only then lets it start drawing over it.
+   */
+  video_end_frame(video);
+  if (!window_hidden && ((present_mode != 'b') || threaded_video))
+    present_frame();
+  export_frame();
+
+  if (terminal_video && term_frame(vdp))
+    death_flag = 1;
+  vdpview_frame(vdp, argb_palette);
+
+  latency_frame++;
+  plan_frame();
+  video_begin_frame(video, skip_frame);
 }
 #endif
 
@@ -1468,6 +2016,10 @@ static void reinit_cpu(void)
   tmp = cpu.userdata;
   init_cpu();
   cpu.userdata = tmp;
+#ifndef __MSDOS__
+  /* The cycle count has gone back to 0; so must the sound's idea of it */
+  sound_reset((uint32_t)cpu.cyc);
+#endif
 }
 
 #ifndef ROM_PATHSPEC
@@ -1590,13 +2142,19 @@ static int init_rom(char *filename)
 #ifndef __MSDOS__
 void audio_callback(void *userdata, Uint8 *stream, int len)
 {
-  int i;
-  int16_t sample;
-  for (i = 0; i < len; i += 2) {
-    sample = PSG_calc(psg);
-    stream[i] = sample & 0xff;
-    stream[i + 1] = sample >> 8;
+  int16_t *samples = (int16_t *)stream;
+
+  sound_fill(samples, len / 2);
+  if (capture_sound)
+    capture_audio(samples, len / 2);
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+  {
+    int i;
+
+    for (i = 0; i < len / 2; i++)
+      samples[i] = SDL_Swap16(samples[i]);
   }
+#endif
 }
 #endif
 
@@ -1704,6 +2262,12 @@ void fatal_diag (int code, char *message)
 #elif (!defined(__APPLE__))&&(!defined(__MSDOS__))
  GtkWidget *widget;
  
+ if (terminal_video)
+ {
+  term_close();
+  fprintf(stderr, "%s\n", message);
+  exit(code);
+ }
  widget=gtk_message_dialog_new(0, GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR, 
                                GTK_BUTTONS_CLOSE, "Marduk");
  gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(widget), "%s",
@@ -1760,6 +2324,16 @@ top:
 #endif
 }
 
+static void usage(const char *name)
+{
+  fprintf(stderr, 
+          "usage: %s [-4 | 8 | -B filename] [-S server] [-P port]"
+          " [-p file] [-s n|l|i] [-i] [-T] [-f n|a]"
+          " [-v file [-A]] [-M name] [-R port] [-t] [-c s|b|sb]"
+          " [-V v|a|i|b] [-q l|h|b] [-m] [-w file] [-g file]\n",
+          name);
+}
+
 int main(int argc, char **argv)
 {
   int e;
@@ -1787,6 +2361,7 @@ int main(int argc, char **argv)
   lpt=NULL;
   inita=initb=NULL;
   cpmexec=NULL;
+  scale_mode='n';
 
   /* This is still relevant for MS-DOS, thank you Watt-32 */
   server = "127.0.0.1";
@@ -1797,7 +2372,7 @@ int main(int argc, char **argv)
    * You can use actual Nabu firmware with the -4, -8 and -B switches.
    */
   bios = OPENNABU;
-  while (-1 != (e = getopt(argc, argv, "48B:jJS:P:Np:a:b:x:")))
+  while (-1 != (e = getopt(argc, argv, "48B:jJS:P:Np:a:b:x:s:iTf:v:AM:R:tc:V:q:mw:g:")))
   {
    switch (e)
    {
@@ -1838,11 +2413,72 @@ int main(int argc, char **argv)
     case 'x':
       cpmexec = optarg;
       break;
+    case 's':
+      scale_mode = *optarg;
+      break;
+#ifndef __MSDOS__
+    case 'i':
+      indexed_video = 1;
+      break;
+    case 'T':
+      threaded_video = 1;
+      break;
+    case 'f':
+      if (!strcmp(optarg, "a"))
+        frame_skip = -1;
+      else
+      {
+        char *end;
+        long n = strtol(optarg, &end, 10);
+
+        if ((end == optarg) || *end || (n < 0) || (n != (int)n))
+        {
+          usage(argv[0]);
+          return 1;
+        }
+        frame_skip = (int)n;
+      }
+      break;
+    case 'v':
+      capture_name = optarg;
+      break;
+    case 'A':
+      capture_sound = 1;
+      break;
+    case 'M':
+      export_name = optarg;
+      break;
+    case 'R':
+      rfb_port = optarg;
+      break;
+    case 't':
+      terminal_video = 1;
+      break;
+    case 'c':
+      crt_scanlines = !!strchr(optarg, 's');
+      crt_blur = !!strchr(optarg, 'b');
+      break;
+    case 'V':
+      present_mode = *optarg;
+      if (!strchr("vaib", present_mode))
+        present_mode = 'i';
+      break;
+    case 'q':
+      sound_quality = (*optarg == 'h') ? PSG_QUALITY_HIGH :
+                      (*optarg == 'b') ? PSG_QUALITY_BLEP : PSG_QUALITY_LOW;
+      break;
+    case 'm':
+      no_sound = 1;
+      break;
+    case 'w':
+      wav_name = optarg;
+      break;
+    case 'g':
+      vgm_name = optarg;
+      break;
+#endif
     default:
-      fprintf(stderr, 
-              "usage: %s [-4 | 8 | -B filename] [-S server] [-P port]"
-              " [-p file]\n",
-              argv[0]);
+      usage(argv[0]);
       return 1;
    }
   }
@@ -1867,6 +2503,11 @@ int main(int argc, char **argv)
 
   /* Only used for the white noise generator; a good RNG isn't necessary. */
   srand(time(0));
+#ifndef __MSDOS__
+  video_init();
+#elif defined(ALLOW_NTSC_NOISE)
+  init_noise();
+#endif
 
 #ifndef __MSDOS__ /* Wait to set MS-DOS video up until later. */
   /*
@@ -1880,7 +2521,9 @@ int main(int argc, char **argv)
    * This will be interrupted by Gtk initialization because we might need to
    * display an error dialog.
    */
-  e=SDL_Init(SDL_INIT_EVERYTHING);
+  e=SDL_Init((terminal_video ? SDL_INIT_TIMER | SDL_INIT_EVENTS
+                             : SDL_INIT_EVERYTHING & ~SDL_INIT_AUDIO) |
+             (no_sound ? 0 : SDL_INIT_AUDIO));
 
   /*
    * SDL MUST be initialized before Gtk, or attempts to use Gtk with SDL will
@@ -1892,7 +2535,8 @@ int main(int argc, char **argv)
    * hacking on our command line could cause Gtk and SDL to go out of synch.
    */
 #if (!defined(_WIN32))&&(!defined(__APPLE__))
-  gtk_init(NULL, NULL);
+  if (!terminal_video) /* there may well be no X server */
+    gtk_init(NULL, NULL);
 #endif
   if (e)
    fatal_diag(2, "FATAL: Could not start SDL");
@@ -1925,26 +2569,55 @@ int main(int argc, char **argv)
   /*
    * Now ready to set up our window and the necessary resources to actually do
    * stuff with it.  If at any time this process fails, die screaming.
+   *
+   * With -t there is no window at all; the terminal is the display.
    */
-  screen = SDL_CreateWindow("Marduk", SDL_WINDOWPOS_UNDEFINED,
-                            SDL_WINDOWPOS_UNDEFINED, 640, 480, 0);
-  if (!screen)
-  {
-    fatal_diag(2, "FATAL: Could not create display");
-    return 2;
-  }
-  renderer = SDL_CreateRenderer(screen, -1, 0);
-  if (!renderer)
-  {
-    fatal_diag(2, "FATAL: Could not set up renderer");
-    return 2;
-  }
-  texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                              SDL_TEXTUREACCESS_STREAMING, 640, 480);
-  if (!texture)
+  if (terminal_video)
+    window_hidden = 1;
+  else
   {
-    fatal_diag(2, "FATAL: Could not create canvas");
-    return 2;
+    screen = SDL_CreateWindow("Marduk", SDL_WINDOWPOS_UNDEFINED,
+                              SDL_WINDOWPOS_UNDEFINED, 640, 480,
+                              SDL_WINDOW_RESIZABLE);
+    if (!screen)
+    {
+      fatal_diag(2, "FATAL: Could not create display");
+      return 2;
+    }
+    renderer = SDL_CreateRenderer(screen, -1,
+                                  ((present_mode == 'v') || (present_mode == 'a'))
+                                  ? SDL_RENDERER_PRESENTVSYNC : 0);
+    if (!renderer)
+    {
+      fatal_diag(2, "FATAL: Could not set up renderer");
+      return 2;
+    }
+
+    /*
+     * The frame is kept at its native 320x240 and the renderer scales it to
+     * whatever size the window is.  The logical size keeps the 4:3 aspect
+     * (letterboxing as needed); -s picks the filter, or whole-number scaling.
+     */
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY,
+                (scale_mode == 'l') ? "linear" : "nearest");
+    SDL_RenderSetLogicalSize(renderer, 320, 240);
+    if (scale_mode == 'i')
+      SDL_RenderSetIntegerScale(renderer, SDL_TRUE);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                SDL_TEXTUREACCESS_STREAMING, 320, 240);
+    if (!texture)
+    {
+      fatal_diag(2, "FATAL: Could not create canvas");
+      return 2;
+    }
+    overlay = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                SDL_TEXTUREACCESS_STATIC, VIDEO_W, VIDEO_OVERLAY_H);
+    if (!overlay)
+    {
+      fatal_diag(2, "FATAL: Could not create canvas");
+      return 2;
+    }
+    SDL_SetTextureBlendMode(overlay, SDL_BLENDMODE_BLEND);
   }
 #endif
 
@@ -1953,38 +2626,63 @@ int main(int argc, char **argv)
    * Even on MS-DOS we will use an offscreen buffer; this will be beneficial
    * with the debugger when we need to flick in and out of text mode.
    * If we can't set aside enough memory for a full offscreen, die screaming.
+   * (With SDL the frame belongs to the video pipeline, made with the VDP.)
    */
 #ifdef __MSDOS__
   display = malloc(64000);
-#else
-  display = calloc(307200, sizeof(uint32_t));
-#endif
   if (!display)
   {
     fatal_diag(2, "FATAL: Not enough memory for offscreen buffer");
     return 2;
   }
+#else
+  video_make_palette(argb_palette);
+#endif
+
+#ifndef __MSDOS__
+  if ((!capture_name) || no_sound)
+    capture_sound = 0;
+  if (capture_name &&
+      capture_open(capture_name, indexed_video, argb_palette, capture_sound, 44100))
+    fatal_diag(2, "FATAL: Could not start capture");
+  if (export_name && shmfb_open(export_name, indexed_video, argb_palette))
+    fatal_diag(2, "FATAL: Could not create shared frame buffer");
+  if (rfb_port && rfb_open(rfb_port, indexed_video, argb_palette, remote_key))
+    fatal_diag(2, "FATAL: Could not start remote display");
+  if (terminal_video && term_open(argb_palette, remote_key))
+    fatal_diag(2, "FATAL: Could not set up the terminal");
+#endif
 
   /*
    * Set up the sound driver.
    * Currently this only works with SDL, but that's everything that isn't DOS.
    */
 #ifndef __MSDOS__
-  SDL_zero(audio_spec);
-  audio_spec.freq = 44100;
-  audio_spec.format = AUDIO_S16LSB;
-  audio_spec.channels = 1;
-  audio_spec.samples = 512;
-  audio_spec.callback = audio_callback;
-
-  audio_device = SDL_OpenAudioDevice(NULL, 0, &audio_spec, NULL, 0);
-  SDL_PauseAudioDevice(audio_device, 0);
+  if (!no_sound)
+  {
+    SDL_zero(audio_spec);
+    audio_spec.freq = 44100;
+    audio_spec.format = AUDIO_S16LSB;
+    audio_spec.channels = 1;
+    audio_spec.samples = 512;
+    audio_spec.callback = audio_callback;
+
+    if (sound_open(CPU_CLOCK, PSG_CLOCK, 44100, sound_quality))
+      fatal_diag(4, "FATAL: Could not set up PSG emulation");
+    audio_device = SDL_OpenAudioDevice(NULL, 0, &audio_spec, NULL, 0);
+    if (audio_device)
+      SDL_PauseAudioDevice(audio_device, 0);
+    else
+      sound_close(); /* nobody to make sound for */
+  }
 #endif
 
   /*
    * Set up the chipset.
-   * Note that the PSG still has to run even if there isn't a sound driver,
-   * because it takes care of other things than just the sound (nonobvious).
+   * Note that the PSG's registers still have to be emulated even if there
+   * isn't a sound driver, because its I/O ports take care of other things
+   * than just the sound (nonobvious).  That's all psgio.c does; what is
+   * heard is made from the register writes by sound.c, if at all.
    */
   
   /* Set up the VDP emulation.  If it fails, die screaming. */
@@ -1992,15 +2690,25 @@ int main(int argc, char **argv)
   if (!vdp)
     fatal_diag(3, "FATAL: Could not set up VDP emulation");
   vrEmuTms9918Reset(vdp);
-
-  /* Set up the PSG emulation.  If it fails, die screaming. */
-  psg = PSG_new(1789772, 44100);
-  if (!psg)
+#ifndef __MSDOS__
+  video = video_new(vdp, argb_palette, indexed_video);
+  if (!video)
   {
-    fatal_diag(4, "FATAL: Could not set up PSG emulation");
+    fatal_diag(2, "FATAL: Not enough memory for offscreen buffer");
+    return 2;
   }
-  PSG_setVolumeMode(psg, 2);
-  PSG_reset(psg);
+  if (threaded_video && video_thread(video))
+    fatal_diag(3, "FATAL: Could not set up VDP render thread");
+#endif
+
+  /* Set up the PSG's registers. */
+  psgio_reset();
+#ifndef __MSDOS__
+  if (wav_name)
+    toggle_wav(wav_name);
+  if (vgm_name)
+    toggle_vgm(vgm_name);
+#endif
   
   /*
    * Set up the modem.
@@ -2118,6 +2826,9 @@ int main(int argc, char **argv)
       }
 
       every_scanline();
+#ifndef __MSDOS__
+      sound_clock((uint32_t)cpu.cyc);
+#endif
 
       /* ready to kick the dog? */
       if (keyboard_buffer_empty())
@@ -2165,9 +2876,25 @@ int main(int argc, char **argv)
   if (lpt) fclose(lpt);
   if (gotmodem)
     modem_deinit();
-  PSG_delete(psg);
+#ifndef __MSDOS__
+  if (terminal_video)
+    term_close();
+  if (latency_count)
+    latency_report();
+  video_free(video);
+  if (capture_name)
+    capture_close();
+  soundlog_wav_close();
+  soundlog_vgm_close((uint32_t)cpu.cyc);
+  if (export_name)
+    shmfb_close();
+  if (rfb_port)
+    rfb_close();
+#endif
   vrEmuTms9918Destroy(vdp);
+#ifdef __MSDOS__
   free(display);
+#endif
   disksys_deinit();
 #ifndef __MSDOS__
   if (joystick) {
@@ -2175,6 +2902,7 @@ int main(int argc, char **argv)
    SDL_GameControllerClose(pad);
   }
   SDL_Quit();
+  sound_close();
 #endif
 
   return 0;
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The PSG as the CPU sees it: its registers, including the two I/O ports.
+ *
+ * The NABU puts its interrupt mask out on port A and reads the interrupt
+ * priority encoder back in on port B, so this has to be there whether or
+ * not any sound is being made.  Making the sound is sound.c's business,
+ * and with no sound nothing else of the PSG is run at all.
+ *
+ * The bits a register doesn't have read back as 0, as on the chip;
+ * registers past 15 aren't there at all.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "psgio.h"
+
+static const uint8_t regmask[16] = {
+ 0xff, 0x0f, 0xff, 0x0f, 0xff, 0x0f, 0x1f, 0xff,
+ 0x1f, 0x1f, 0x1f, 0xff, 0xff, 0x0f, 0xff, 0xff
+};
+
+static uint8_t regs[16];
+
+void psgio_reset (void)
+{
+ memset(regs, 0, sizeof(regs));
+}
+
+void psgio_write (uint8_t reg, uint8_t val)
+{
+ if (reg<16) regs[reg]=val&regmask[reg];
+}
+
+uint8_t psgio_read (uint8_t reg)
+{
+ return (reg<16)?regs[reg]:0;
+}
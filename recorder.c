@@ -0,0 +1,218 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Writing a stream of bytes to a file without holding up whoever makes it.
+ *
+ * The bytes go into a ring, which a writer thread of its own empties onto
+ * the disk every so often; if the ring fills, what doesn't fit is dropped
+ * (and counted) rather than waiting.  Each RECORDER is fed by one thread,
+ * and started and stopped by another.
+ *
+ * On top of that, a .wav of 16-bit mono samples, used both for the sound
+ * captured beside a video (-A) and for recording the sound alone (-w, F5).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL.h>
+#include "recorder.h"
+
+#define RECORDER_WAKE 20 /* ms between the writer emptying the ring */
+
+#define WAV_HEADER 44
+
+static void put16 (uint8_t *p, unsigned v)
+{
+ p[0]=v&0xFF;
+ p[1]=(v>>8)&0xFF;
+}
+
+static void put32 (uint8_t *p, unsigned long v)
+{
+ put16(p, v&0xFFFF);
+ put16(p+2, (v>>16)&0xFFFF);
+}
+
+/* Write out whatever has built up. */
+static void drain (RECORDER *r)
+{
+ unsigned in, out, n, at;
+
+ in=SDL_AtomicGet(&r->in);
+ out=SDL_AtomicGet(&r->out);
+ while (in!=out)
+ {
+  at=out%RECORDER_RING;
+  n=in-out;
+  if (n>RECORDER_RING-at) n=RECORDER_RING-at;
+  fwrite(r->ring+at, 1, n, r->file);
+  r->bytes+=n;
+  out+=n;
+ }
+ SDL_AtomicSet(&r->out, out);
+}
+
+static int recorder_writer (void *p)
+{
+ RECORDER *r=p;
+
+ while (!SDL_AtomicGet(&r->stopping))
+ {
+  SDL_Delay(RECORDER_WAKE);
+  drain(r);
+ }
+ drain(r);
+ return 0;
+}
+
+/*
+ * Start r's writer on file, which already has whatever header it needs
+ * written.  On failure the file is closed.
+ */
+int recorder_start (RECORDER *r, FILE *file)
+{
+ r->file=file;
+ r->bytes=r->dropped=0;
+ SDL_AtomicSet(&r->out, SDL_AtomicGet(&r->in));
+ SDL_AtomicSet(&r->stopping, 0);
+ r->writer=SDL_CreateThread(recorder_writer, "recorder", r);
+ if (!r->writer)
+ {
+  fclose(file);
+  r->file=NULL;
+  return -1;
+ }
+ SDL_AtomicSet(&r->on, 1);
+ return 0;
+}
+
+/*
+ * Stop taking anything for r, and wait for the writer to finish.  The file
+ * is left open, at its end, for the header to be finished off.
+ */
+void recorder_stop (RECORDER *r)
+{
+ SDL_AtomicSet(&r->on, 0);
+ SDL_AtomicSet(&r->stopping, 1);
+ SDL_WaitThread(r->writer, NULL);
+ r->writer=NULL;
+}
+
+/* Queue len bytes, from the one thread that feeds r.  Never waits. */
+void recorder_put (RECORDER *r, const void *data, unsigned len)
+{
+ const uint8_t *d=data;
+ unsigned in, n, at;
+
+ if (!SDL_AtomicGet(&r->on)) return;
+
+ in=SDL_AtomicGet(&r->in);
+ if (len>RECORDER_RING-(in-SDL_AtomicGet(&r->out)))
+ {
+  r->dropped+=len;
+  return;
+ }
+ while (len)
+ {
+  at=in%RECORDER_RING;
+  n=len;
+  if (n>RECORDER_RING-at) n=RECORDER_RING-at;
+  memcpy(r->ring+at, d, n);
+  d+=n;
+  len-=n;
+  in+=n;
+ }
+ SDL_AtomicSet(&r->in, in);
+}
+
+/* 44-byte PCM header; the sizes are filled in when the file is closed. */
+static void wav_header (RECORDER *r)
+{
+ uint8_t h[WAV_HEADER];
+
+ memcpy(h, "RIFF", 4);
+ put32(h+4, 36+r->bytes);
+ memcpy(h+8, "WAVEfmt ", 8);
+ put32(h+16, 16);
+ put16(h+20, 1);      /* PCM */
+ put16(h+22, 1);      /* mono */
+ put32(h+24, r->rate);
+ put32(h+28, r->rate*2);
+ put16(h+32, 2);
+ put16(h+34, 16);
+ memcpy(h+36, "data", 4);
+ put32(h+40, r->bytes);
+ fseek(r->file, 0, SEEK_SET);
+ fwrite(h, 1, WAV_HEADER, r->file);
+ fseek(r->file, 0, SEEK_END);
+}
+
+/* Start recording to a .wav, at rate samples a second. */
+int recorder_wav_open (RECORDER *r, const char *filename, uint32_t rate)
+{
+ FILE *file;
+
+ if (r->writer) return -1;
+
+ file=fopen(filename, "wb");
+ if (!file)
+ {
+  perror(filename);
+  return -1;
+ }
+ r->file=file;
+ r->rate=rate;
+ r->bytes=0;
+ wav_header(r);
+ return recorder_start(r, file);
+}
+
+/* Record n samples, from the thread that feeds r. */
+void recorder_wav_put (RECORDER *r, const int16_t *samples, int n)
+{
+ uint8_t buf[512];
+ int i, k;
+
+ if (!SDL_AtomicGet(&r->on)) return;
+
+ while (n)
+ {
+  k=(n>(int)sizeof(buf)/2)?(int)sizeof(buf)/2:n;
+  for (i=0; i<k; i++)
+   put16(buf+i*2, (uint16_t)samples[i]);
+  recorder_put(r, buf, k*2);
+  samples+=k;
+  n-=k;
+ }
+}
+
+/* Finish the .wav off.  r->bytes and r->dropped are left for the caller. */
+void recorder_wav_close (RECORDER *r)
+{
+ if (!r->writer) return;
+
+ recorder_stop(r);
+ wav_header(r);
+ fclose(r->file);
+ r->file=NULL;
+}
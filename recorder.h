@@ -0,0 +1,49 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef H_RECORDER
+#define H_RECORDER
+
+#include <stdint.h>
+#include <stdio.h>
+#include <SDL.h>
+
+#define RECORDER_RING 65536 /* bytes; about 3/4 second of .wav */
+
+typedef struct
+{
+ FILE *file;
+ uint8_t ring[RECORDER_RING];
+ SDL_atomic_t in, out, on, stopping;
+ SDL_Thread *writer;
+ unsigned long bytes, dropped;
+ uint32_t rate;
+} RECORDER;
+
+int recorder_start (RECORDER *r, FILE *file);
+void recorder_stop (RECORDER *r);
+void recorder_put (RECORDER *r, const void *data, unsigned len);
+
+int recorder_wav_open (RECORDER *r, const char *filename, uint32_t rate);
+void recorder_wav_put (RECORDER *r, const int16_t *samples, int n);
+void recorder_wav_close (RECORDER *r);
+
+#endif /* H_RECORDER */
@@ -0,0 +1,604 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Remote display: a small RFB (VNC) server, for looking in on (and typing
+ * into) a NABU that's running somewhere without anyone in front of it.
+ *
+ * It listens on the loopback address only - reach it through an SSH tunnel
+ * or similar - takes one viewer at a time, offers no authentication, and
+ * sends Raw rectangles, which every viewer understands.  What keeps it
+ * cheap is that nothing is sent that the viewer already has: the frame is
+ * split into 16x16 tiles, tiles are compared against a copy of what was
+ * last sent only when the emulator actually redrew part of the frame, and
+ * only tiles that differ go out.  A still screen costs nothing, and a
+ * viewer that can't keep up just gets fewer, bigger updates.
+ *
+ * Everything is done from rfb_frame(), called once per frame on the main
+ * thread, with non-blocking sockets, so the emulation never waits on the
+ * network.  Keys are handed back through the callback as X11 keysyms.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rfb.h"
+
+#if defined(__MSDOS__)
+int rfb_open (char *port, int indexed, const uint32_t *palette,
+              void (*key)(uint32_t keysym, int down))
+{
+ fprintf(stderr, "Remote display is not supported here\n");
+ return -1;
+}
+
+void rfb_close (void)
+{
+}
+
+void rfb_frame (const void *frame, int touched)
+{
+}
+#else
+#ifdef _WIN32
+# include <winsock2.h>
+# include <ws2tcpip.h>
+# define WOULDBLOCK (WSAGetLastError()==WSAEWOULDBLOCK)
+#else
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/socket.h>
+# include <sys/types.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+# include <arpa/inet.h>
+# define closesocket close
+# define WOULDBLOCK ((errno==EAGAIN)||(errno==EWOULDBLOCK))
+#endif
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0 /* the viewer hanging up mustn't kill us */
+#endif
+
+#define TILE 16
+#define TILES_X (RFB_W/TILE)
+#define TILES_Y (RFB_H/TILE)
+
+enum
+{
+ RFB_VERSION,   /* waiting for the viewer's protocol version */
+ RFB_SECURITY,  /* waiting for it to pick "None"             */
+ RFB_INIT,      /* waiting for ClientInit                    */
+ RFB_NORMAL
+};
+
+static int lsock=-1, csock=-1;
+static int state, minor;
+static void (*key_handler)(uint32_t keysym, int down);
+
+static int indexed, bytes_in;
+static const uint32_t *palette;
+static uint8_t *shadow;
+
+static uint8_t inbuf[1024];
+static int inlen;
+static unsigned long skip;
+
+static uint8_t *outbuf;
+static size_t outlen, outpos, outsize;
+
+static int update_wanted, full_wanted, changed;
+
+/* The viewer's pixel format */
+static int bpp, big_endian;
+static unsigned rmax, gmax, bmax, rshift, gshift, bshift;
+
+static void set_nonblock (int s)
+{
+#ifdef _WIN32
+ u_long on=1;
+
+ ioctlsocket(s, FIONBIO, &on);
+#else
+ fcntl(s, F_SETFL, fcntl(s, F_GETFL)|O_NONBLOCK);
+#endif
+}
+
+static void drop_client (char *why)
+{
+ if (why) fprintf(stderr, "Remote display: %s\n", why);
+ closesocket(csock);
+ csock=-1;
+}
+
+static int out_reserve (size_t n)
+{
+ if (outlen+n>outsize)
+ {
+  uint8_t *p;
+  size_t s=outsize?outsize:4096;
+
+  while (s<outlen+n) s*=2;
+  p=realloc(outbuf, s);
+  if (!p) return -1;
+  outbuf=p;
+  outsize=s;
+ }
+ return 0;
+}
+
+static void out_put (const void *data, size_t n)
+{
+ if (out_reserve(n)) return;
+ memcpy(outbuf+outlen, data, n);
+ outlen+=n;
+}
+
+static void out_u8 (unsigned v)
+{
+ uint8_t b=v;
+
+ out_put(&b, 1);
+}
+
+static void out_u16 (unsigned v)
+{
+ uint8_t b[2];
+
+ b[0]=v>>8;
+ b[1]=v;
+ out_put(b, 2);
+}
+
+static void out_u32 (unsigned long v)
+{
+ uint8_t b[4];
+
+ b[0]=v>>24;
+ b[1]=v>>16;
+ b[2]=v>>8;
+ b[3]=v;
+ out_put(b, 4);
+}
+
+static unsigned get16 (const uint8_t *p)
+{
+ return (p[0]<<8)|p[1];
+}
+
+static unsigned long get32 (const uint8_t *p)
+{
+ return ((unsigned long)p[0]<<24)|((unsigned long)p[1]<<16)|(p[2]<<8)|p[3];
+}
+
+/* Send what we can without waiting; the rest goes next frame. */
+static void flush_out (void)
+{
+ while (outpos<outlen)
+ {
+  int e=send(csock, (const char *)outbuf+outpos, outlen-outpos, MSG_NOSIGNAL);
+
+  if (e<0)
+  {
+   if (!WOULDBLOCK) drop_client("viewer went away");
+   return;
+  }
+  outpos+=e;
+ }
+ outpos=outlen=0;
+}
+
+static void send_server_init (void)
+{
+ out_u16(RFB_W);
+ out_u16(RFB_H);
+
+ /* 32-bit little-endian xRGB, which is what we hold anyway */
+ out_u8(32);
+ out_u8(24);
+ out_u8(0);
+ out_u8(1);
+ out_u16(255);
+ out_u16(255);
+ out_u16(255);
+ out_u8(16);
+ out_u8(8);
+ out_u8(0);
+ out_u8(0);
+ out_u8(0);
+ out_u8(0);
+
+ out_u32(6);
+ out_put("marduk", 6);
+
+ bpp=32;
+ big_endian=0;
+ rmax=gmax=bmax=255;
+ rshift=16;
+ gshift=8;
+ bshift=0;
+}
+
+/*
+ * Deal with one message (or handshake step) at the start of inbuf.
+ * Returns how many bytes it took, or 0 if it isn't all here yet.
+ */
+static int client_message (void)
+{
+ switch (state)
+ {
+  case RFB_VERSION:
+   if (inlen<12) return 0;
+   if (memcmp(inbuf, "RFB 003.", 8))
+   {
+    drop_client("not a VNC viewer");
+    return 0;
+   }
+   minor=atoi((char *)inbuf+8);
+   if (minor>=8)
+    minor=8;
+   else if (minor!=7)
+    minor=3;
+
+   if (minor==3)  /* 3.3: the server just says there's no security */
+   {
+    out_u32(1);
+    state=RFB_INIT;
+   }
+   else
+   {
+    out_u8(1);
+    out_u8(1);
+    state=RFB_SECURITY;
+   }
+   return 12;
+  case RFB_SECURITY:
+   if (*inbuf!=1)
+   {
+    drop_client("viewer wants a password, and we have none");
+    return 0;
+   }
+   if (minor==8) out_u32(0);
+   state=RFB_INIT;
+   return 1;
+  case RFB_INIT:
+   send_server_init();
+   state=RFB_NORMAL;
+   return 1;
+ }
+
+ switch (*inbuf)
+ {
+  case 0: /* SetPixelFormat */
+   if (inlen<20) return 0;
+   if (!inbuf[7])
+   {
+    drop_client("viewer wants a color map, which isn't supported");
+    return 0;
+   }
+   bpp=inbuf[4];
+   if ((bpp!=8)&&(bpp!=16)&&(bpp!=32))
+   {
+    drop_client("viewer wants an odd pixel size");
+    return 0;
+   }
+   big_endian=inbuf[6];
+   rmax=get16(inbuf+8);
+   gmax=get16(inbuf+10);
+   bmax=get16(inbuf+12);
+   rshift=inbuf[14];
+   gshift=inbuf[15];
+   bshift=inbuf[16];
+   return 20;
+  case 2: /* SetEncodings - Raw is all we do, and it's always allowed */
+   if (inlen<4) return 0;
+   skip=4UL*get16(inbuf+2);
+   return 4;
+  case 3: /* FramebufferUpdateRequest */
+   if (inlen<10) return 0;
+   update_wanted=1;
+   if (!inbuf[1]) full_wanted=1;
+   return 10;
+  case 4: /* KeyEvent */
+   if (inlen<8) return 0;
+   if (key_handler) key_handler(get32(inbuf+4), inbuf[1]);
+   return 8;
+  case 5: /* PointerEvent - the NABU has no mouse */
+   if (inlen<6) return 0;
+   return 6;
+  case 6: /* ClientCutText */
+   if (inlen<8) return 0;
+   skip=get32(inbuf+4);
+   return 8;
+  default:
+   drop_client("viewer sent something we don't understand");
+   return 0;
+ }
+}
+
+static void read_client (void)
+{
+ while (csock>=0)
+ {
+  int e, n;
+
+  e=recv(csock, (char *)inbuf+inlen, sizeof(inbuf)-inlen, 0);
+  if (!e)
+  {
+   drop_client("viewer disconnected");
+   return;
+  }
+  if (e<0)
+  {
+   if (!WOULDBLOCK) drop_client("viewer went away");
+   return;
+  }
+  inlen+=e;
+
+  while (inlen && (csock>=0))
+  {
+   if (skip)
+   {
+    unsigned long have=inlen;
+
+    n=(int)((skip<have)?skip:have);
+    skip-=n;
+   }
+   else
+   {
+    n=client_message();
+    if (!n) break;
+   }
+   memmove(inbuf, inbuf+n, inlen-n);
+   inlen-=n;
+  }
+ }
+}
+
+static void put_pixel (uint8_t *p, uint32_t argb)
+{
+ uint32_t v;
+
+ v=((((argb>>16)&0xFF)*rmax+127)/255)<<rshift
+  |((((argb>>8)&0xFF)*gmax+127)/255)<<gshift
+  |(((argb&0xFF)*bmax+127)/255)<<bshift;
+
+ switch (bpp)
+ {
+  case 8:
+   *p=v;
+   break;
+  case 16:
+   p[big_endian?0:1]=v>>8;
+   p[big_endian?1:0]=v;
+   break;
+  default:
+   if (big_endian)
+   {
+    p[0]=v>>24;
+    p[1]=v>>16;
+    p[2]=v>>8;
+    p[3]=v;
+   }
+   else
+   {
+    p[0]=v;
+    p[1]=v>>8;
+    p[2]=v>>16;
+    p[3]=v>>24;
+   }
+ }
+}
+
+/* Has tile (tx, ty) changed since it was last sent? */
+static int tile_changed (const uint8_t *frame, int tx, int ty)
+{
+ int y;
+ size_t o=((size_t)ty*TILE*RFB_W+tx*TILE)*bytes_in;
+
+ for (y=0; y<TILE; y++, o+=RFB_W*bytes_in)
+  if (memcmp(frame+o, shadow+o, TILE*bytes_in)) return 1;
+ return 0;
+}
+
+/*
+ * Queue a FramebufferUpdate with every changed tile (or all of them), as
+ * one rectangle per run of changed tiles along a row of tiles.  Returns
+ * the number of rectangles.
+ */
+static int send_update (const uint8_t *frame, int full)
+{
+ uint8_t dirty[TILES_Y][TILES_X];
+ int tx, ty, x, y, run, rects;
+
+ rects=0;
+ for (ty=0; ty<TILES_Y; ty++)
+  for (tx=0; tx<TILES_X; tx++)
+  {
+   dirty[ty][tx]=full||tile_changed(frame, tx, ty);
+   if (dirty[ty][tx]&&(!tx||!dirty[ty][tx-1])) rects++;
+  }
+ if (!rects) return 0;
+
+ out_u8(0);
+ out_u8(0);
+ out_u16(rects);
+ for (ty=0; ty<TILES_Y; ty++)
+  for (tx=0; tx<TILES_X; tx+=run)
+  {
+   size_t o;
+
+   for (run=0; (tx+run<TILES_X)&&dirty[ty][tx+run]; run++);
+   if (!run)
+   {
+    run=1;
+    continue;
+   }
+
+   out_u16(tx*TILE);
+   out_u16(ty*TILE);
+   out_u16(run*TILE);
+   out_u16(TILE);
+   out_u32(0); /* Raw */
+
+   if (out_reserve((size_t)run*TILE*TILE*(bpp/8))) return rects;
+   for (y=ty*TILE; y<(ty+1)*TILE; y++)
+   {
+    o=((size_t)y*RFB_W+tx*TILE)*bytes_in;
+    for (x=0; x<run*TILE; x++)
+    {
+     put_pixel(outbuf+outlen,
+               indexed?palette[frame[o+x]]:((const uint32_t *)(frame+o))[x]);
+     outlen+=bpp/8;
+    }
+    memcpy(shadow+o, frame+o, run*TILE*bytes_in);
+   }
+  }
+ return rects;
+}
+
+static void accept_client (void)
+{
+ int s;
+
+ s=accept(lsock, 0, 0);
+ if (s<0) return;
+ if (csock>=0)   /* one at a time */
+ {
+  closesocket(s);
+  return;
+ }
+ csock=s;
+ set_nonblock(csock);
+#ifdef TCP_NODELAY
+ {
+  int on=1;
+
+  setsockopt(csock, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+ }
+#endif
+ fprintf(stderr, "Remote display: viewer connected\n");
+
+ inlen=0;
+ skip=0;
+ outlen=outpos=0;
+ update_wanted=0;
+ full_wanted=1;
+ state=RFB_VERSION;
+ out_put("RFB 003.008\n", 12);
+}
+
+/*
+ * Called at the end of every frame, with whether any of it was redrawn.
+ */
+void rfb_frame (const void *frame, int touched)
+{
+ if (lsock<0) return;
+
+ accept_client();
+ if (csock<0) return;
+
+ read_client();
+ if (touched) changed=1;
+ if (csock>=0) flush_out();
+
+ /*
+  * Only build an update once the last one is out of the door; whatever
+  * changes meanwhile just goes into the next.
+  */
+ if ((csock>=0)&&(state==RFB_NORMAL)&&update_wanted&&!outlen&&
+     (changed||full_wanted))
+ {
+  if (send_update(frame, full_wanted))
+   update_wanted=0;
+  changed=full_wanted=0;
+  flush_out();
+ }
+}
+
+/*
+ * Listen on the loopback address at port.  Returns 0 on success.
+ */
+int rfb_open (char *port, int indexed_frame, const uint32_t *pal,
+              void (*key)(uint32_t keysym, int down))
+{
+ struct sockaddr_in sin;
+ int on=1;
+#ifdef _WIN32
+ WSADATA wsadata;
+
+ if (WSAStartup(MAKEWORD(2,2), &wsadata))
+ {
+  fprintf (stderr, "TCP library failed to initialize\n");
+  return -1;
+ }
+#endif
+
+ indexed=indexed_frame;
+ bytes_in=indexed?1:4;
+ palette=pal;
+ key_handler=key;
+
+ shadow=calloc(RFB_W*RFB_H, bytes_in);
+ if (!shadow) return -1;
+
+ lsock=socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+ if (lsock<0)
+ {
+  perror("Could not get a socket");
+  return -1;
+ }
+ setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+
+ memset(&sin, 0, sizeof(sin));
+ sin.sin_family=AF_INET;
+ sin.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+ sin.sin_port=htons(atoi(port));
+ if (bind(lsock, (struct sockaddr *)&sin, sizeof(sin))||listen(lsock, 1))
+ {
+  perror("Could not listen for remote display");
+  closesocket(lsock);
+  lsock=-1;
+  return -1;
+ }
+ set_nonblock(lsock);
+ fprintf(stderr, "Remote display listening on 127.0.0.1:%s\n", port);
+ return 0;
+}
+
+void rfb_close (void)
+{
+ if (csock>=0) drop_client(0);
+ if (lsock>=0)
+ {
+  closesocket(lsock);
+  lsock=-1;
+#ifdef _WIN32
+  WSACleanup();
+#endif
+ }
+ free(shadow);
+ free(outbuf);
+ shadow=outbuf=0;
+ outsize=outlen=outpos=0;
+}
+#endif
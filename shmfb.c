@@ -0,0 +1,152 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Shared-memory frame export.
+ *
+ * Each finished frame is copied into a small ring in a POSIX shared memory
+ * object, where any number of viewers can pick it up without the emulator
+ * doing any more work than one memcpy.  See shmfb.h for the layout.
+ *
+ * Not available on Windows or MS-DOS.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shmfb.h"
+
+#if defined(_WIN32)||defined(__MSDOS__)
+int shmfb_open (char *name, int indexed, const uint32_t *palette)
+{
+ fprintf(stderr, "%s: shared memory export is not supported here\n", name);
+ return -1;
+}
+
+void shmfb_publish (const void *frame)
+{
+}
+
+void shmfb_close (void)
+{
+}
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHMFB_W 320
+#define SHMFB_H 240
+
+static char *shm_name;
+static shmfb_header *shm;
+static size_t shm_size;
+static uint64_t sequence;
+
+/*
+ * Create (or take over) the object called name, which by POSIX convention
+ * begins with a slash; one is added if not.  Returns 0 on success.
+ */
+int shmfb_open (char *name, int indexed, const uint32_t *palette)
+{
+ size_t offset, slot_bytes;
+ int fd;
+
+ shm_name=malloc(strlen(name)+2);
+ if (!shm_name) return -1;
+ sprintf(shm_name, "%s%s", (*name=='/')?"":"/", name);
+
+ slot_bytes=SHMFB_W*SHMFB_H*(indexed?1:4);
+ offset=(sizeof(shmfb_header)+63)&~(size_t)63;
+ shm_size=offset+SHMFB_SLOTS*slot_bytes;
+
+ fd=shm_open(shm_name, O_RDWR|O_CREAT, 0644);
+ if (fd<0)
+ {
+  perror(shm_name);
+  return -1;
+ }
+ if (ftruncate(fd, shm_size))
+ {
+  perror(shm_name);
+  close(fd);
+  return -1;
+ }
+ shm=mmap(0, shm_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+ close(fd);
+ if (shm==MAP_FAILED)
+ {
+  perror(shm_name);
+  shm=NULL;
+  return -1;
+ }
+
+ memset(shm, 0, offset);
+ shm->version=SHMFB_VERSION;
+ shm->width=SHMFB_W;
+ shm->height=SHMFB_H;
+ shm->format=indexed?SHMFB_INDEX8:SHMFB_ARGB8888;
+ shm->stride=SHMFB_W*(indexed?1:4);
+ shm->slots=SHMFB_SLOTS;
+ shm->slot_bytes=slot_bytes;
+ shm->offset=offset;
+ if (indexed)
+  memcpy(shm->palette, palette, sizeof(shm->palette));
+
+ /* Magic last, so a viewer never sees a half-made header. */
+ __sync_synchronize();
+ memcpy(shm->magic, SHMFB_MAGIC, 8);
+ return 0;
+}
+
+/* Copy a finished frame into the next slot and announce it. */
+void shmfb_publish (const void *frame)
+{
+ int s;
+
+ if (!shm) return;
+
+ s=sequence%SHMFB_SLOTS;
+ shm->stamp[s]=0;
+ __sync_synchronize();
+ memcpy((uint8_t *)shm+shm->offset+s*shm->slot_bytes, frame, shm->slot_bytes);
+ __sync_synchronize();
+ sequence++;
+ shm->stamp[s]=sequence;
+ __sync_synchronize();
+ shm->sequence=sequence;
+}
+
+/* The object is removed, but viewers that have it mapped keep their copy. */
+void shmfb_close (void)
+{
+ if (shm)
+ {
+  munmap(shm, shm_size);
+  shm=NULL;
+  shm_unlink(shm_name);
+ }
+ free(shm_name);
+ shm_name=NULL;
+}
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef H_SHMFB
+#define H_SHMFB
+
+#include <stdint.h>
+
+/*
+ * Layout of the shared-memory frame export (-M name), for viewers.
+ *
+ * The object holds this header followed by SHMFB_SLOTS frames of
+ * slot_bytes each, starting at the offset given in the header.  Frame n
+ * (counting from 1) goes in slot (n - 1) % SHMFB_SLOTS.  To read:
+ *
+ *   1. read sequence; if it is 0 (or hasn't changed) there's nothing new
+ *   2. pick slot (sequence - 1) % SHMFB_SLOTS and note stamp[slot]
+ *   3. copy the frame out
+ *   4. if stamp[slot] is still the same, the copy is good; else retry
+ *
+ * The writer sets a slot's stamp to 0 while writing it, then to the frame
+ * number, and only then advances sequence.
+ */
+#define SHMFB_MAGIC   "MARDUKFB"
+#define SHMFB_VERSION 1
+#define SHMFB_SLOTS   3
+
+#define SHMFB_ARGB8888 0 /* 32-bit pixels, host byte order */
+#define SHMFB_INDEX8   1 /* color numbers into palette[] */
+
+typedef struct
+{
+ char magic[8];
+ uint32_t version;
+ uint32_t width, height;
+ uint32_t format;
+ uint32_t stride;           /* bytes per row */
+ uint32_t slots;
+ uint32_t slot_bytes;
+ uint32_t offset;           /* of slot 0, from the start of the object */
+ uint32_t palette[256];     /* ARGB8888, for SHMFB_INDEX8 */
+ volatile uint64_t sequence;
+ volatile uint64_t stamp[SHMFB_SLOTS];
+} shmfb_header;
+
+int shmfb_open (char *name, int indexed, const uint32_t *palette);
+void shmfb_publish (const void *frame);
+void shmfb_close (void);
+
+#endif /* H_SHMFB */
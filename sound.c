@@ -0,0 +1,241 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Sound synthesis, on the audio thread.
+ *
+ * The emulated PSG (in main.c) is only a register file: it is what the CPU
+ * reads back, and what drives the interrupt lines through its ports.  What
+ * is heard comes from a second PSG here, which only the audio thread
+ * touches.  Register writes get to it through a single-producer,
+ * single-consumer ring, each stamped with the CPU cycle it happened on, so
+ * neither side ever waits for the other.
+ *
+ * The audio thread plays emulated time a little behind the emulation (a
+ * couple of buffers), and each write takes effect on the sample it falls
+ * on, rather than all of a buffer's writes at once at the start of it.
+ * If the two clocks drift too far apart (the emulation stalled, or ran
+ * ahead unthrottled), the audio jumps to catch up.  A reset starts the
+ * CPU's cycle count again from 0; writes queued from before it are then
+ * applied at once, rather than waiting for the count to get back to them.
+ *
+ * Only the sound registers, 0-13, come through here; the I/O ports are of
+ * no interest to the synthesis.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <SDL.h>
+#include "emu2149.h"
+#include "sound.h"
+#include "soundlog.h"
+
+#define SOUND_RING 4096 /* register writes; a frame uses a few dozen */
+#define SOUND_LAG  2    /* buffers the audio plays behind the emulation */
+
+typedef struct
+{
+ uint32_t cycle;
+ uint8_t reg, val;
+} sound_event;
+
+static PSG *synth;
+static uint32_t cpu_hz, sample_hz;
+
+static sound_event ring[SOUND_RING];
+static SDL_atomic_t ring_in, ring_out;
+static SDL_atomic_t emu_clock;
+static SDL_atomic_t reset_pending, reset_at;
+
+/*
+ * Emulation side.  If the ring ever fills (the audio thread not keeping
+ * up) writes are dropped, and once there's room again every register is
+ * sent over as it now stands, so nothing is left wrong for long.
+ */
+static uint8_t shadow[14];
+static int overflowed;
+
+/* Audio side: the cycle (and fraction, in 1/sample_hz) of the next sample */
+static uint32_t play_cycle, play_frac;
+static int play_synced;
+static unsigned stale_end; /* ring index before which stamps are stale */
+
+int sound_open (uint32_t cpu_clock, uint32_t psg_clock, uint32_t rate,
+                int quality)
+{
+ synth=PSG_new(psg_clock, rate);
+ if (!synth) return -1;
+ PSG_setQuality(synth, quality);
+
+ /* The NABU has an AY-3-8910 */
+ PSG_setVolumeMode(synth, 2);
+ PSG_reset(synth);
+
+ cpu_hz=cpu_clock;
+ sample_hz=rate;
+ SDL_AtomicSet(&ring_in, 0);
+ SDL_AtomicSet(&ring_out, 0);
+ SDL_AtomicSet(&reset_pending, 0);
+ memset(shadow, 0, sizeof(shadow));
+ overflowed=0;
+ play_synced=0;
+ stale_end=0;
+ return 0;
+}
+
+void sound_close (void)
+{
+ if (synth) PSG_delete(synth);
+ synth=NULL;
+}
+
+static int push (uint32_t cycle, uint8_t reg, uint8_t val)
+{
+ unsigned in;
+
+ in=SDL_AtomicGet(&ring_in);
+ if (in-SDL_AtomicGet(&ring_out)>=SOUND_RING)
+  return -1;
+
+ ring[in%SOUND_RING].cycle=cycle;
+ ring[in%SOUND_RING].reg=reg;
+ ring[in%SOUND_RING].val=val;
+ SDL_AtomicSet(&ring_in, in+1);
+ return 0;
+}
+
+/* The CPU wrote val to PSG register reg on the given cycle */
+void sound_write (uint32_t cycle, uint8_t reg, uint8_t val)
+{
+ int r;
+
+ if ((!synth)||(reg>13)) return;
+
+ shadow[reg]=val;
+ if (overflowed)
+ {
+  if (SOUND_RING-(SDL_AtomicGet(&ring_in)-SDL_AtomicGet(&ring_out))<14)
+   return;
+  for (r=0; r<14; r++)
+   push(cycle, r, shadow[r]);
+  overflowed=0;
+  return;
+ }
+ if (push(cycle, reg, val))
+  overflowed=1;
+}
+
+/* Emulated time has got as far as this cycle */
+void sound_clock (uint32_t cycle)
+{
+ SDL_AtomicSet(&emu_clock, (int)cycle);
+}
+
+/*
+ * The CPU was reset, and its cycle count starts again from cycle.  Tell
+ * the audio thread that whatever is queued so far is from before.
+ */
+void sound_reset (uint32_t cycle)
+{
+ SDL_AtomicSet(&emu_clock, (int)cycle);
+ SDL_AtomicSet(&reset_at, SDL_AtomicGet(&ring_in));
+ SDL_AtomicSet(&reset_pending, 1);
+}
+
+/*
+ * Make n samples.  Each write due by the end of the buffer is applied at
+ * its own sample, with the samples before it made as things stood.
+ */
+void sound_fill (int16_t *out, int n)
+{
+ uint32_t span, target;
+ int32_t ahead;
+ int at, k;
+ unsigned in, o;
+ uint64_t t;
+
+ if (!synth)
+ {
+  memset(out, 0, n*sizeof(int16_t));
+  return;
+ }
+
+ if (SDL_AtomicGet(&reset_pending))
+ {
+  stale_end=(unsigned)SDL_AtomicGet(&reset_at);
+  SDL_AtomicSet(&reset_pending, 0);
+  play_synced=0;
+ }
+
+ /* Keep about SOUND_LAG buffers behind the emulation */
+ span=(uint32_t)((uint64_t)n*cpu_hz/sample_hz);
+ target=(uint32_t)SDL_AtomicGet(&emu_clock)-SOUND_LAG*span;
+ ahead=(int32_t)(play_cycle-target);
+ if ((!play_synced)||(ahead>(int32_t)(SOUND_LAG*span))||
+     (ahead<-(int32_t)(SOUND_LAG*span)))
+ {
+  play_cycle=target;
+  play_frac=0;
+  play_synced=1;
+ }
+
+ at=0;
+ in=SDL_AtomicGet(&ring_in);
+ for (o=SDL_AtomicGet(&ring_out); o!=in; o++)
+ {
+  sound_event *e=&ring[o%SOUND_RING];
+  int32_t d=(int32_t)(e->cycle-play_cycle);
+
+  /*
+   * The sample it falls on: the first at or after its cycle.  Anything
+   * from before a reset, or stamped further ahead than the emulation can
+   * be, is out of step with play_cycle, and goes in straight away.
+   */
+  if ((d<=0)||((int)(o-stale_end)<0)||
+      (d>(int32_t)((2*SOUND_LAG+1)*span)))
+   k=0;
+  else
+  {
+   t=((uint64_t)d*sample_hz-play_frac+cpu_hz-1)/cpu_hz;
+   if (t>=(uint64_t)n) break; /* next time */
+   k=(int)t;
+  }
+
+  if (k>at)
+  {
+   PSG_calcBlock(synth, out+at, k-at);
+   at=k;
+  }
+  PSG_writeReg(synth, e->reg, e->val);
+ }
+ SDL_AtomicSet(&ring_out, o);
+ if ((int)(o-stale_end)>0)
+  stale_end=o; /* keep it close, so the comparison never wraps */
+
+ if (at<n)
+  PSG_calcBlock(synth, out+at, n-at);
+ soundlog_samples(out, n);
+
+ /* Move on by n samples */
+ t=(uint64_t)n*cpu_hz+play_frac;
+ play_cycle+=(uint32_t)(t/sample_hz);
+ play_frac=(uint32_t)(t%sample_hz);
+}
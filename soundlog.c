@@ -0,0 +1,219 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Sound recording, two ways.
+ *
+ * A .wav is what the audio thread synthesises, as it is played: sound.c
+ * hands each buffer over as it is made.
+ *
+ * A .vgm is a log of the writes to the PSG's sound registers, with the
+ * emulated time of each, as the CPU makes them.  It is tiny, and VGM
+ * players (or vgm2wav) can render it again later at whatever quality.
+ *
+ * Neither is written by the thread producing it; both go through a
+ * RECORDER (recorder.c), as the sound captured with a video does.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL.h>
+#include "recorder.h"
+#include "soundlog.h"
+
+#define VGM_HEADER 0x80
+#define VGM_RATE   44100 /* the samples VGM counts time in */
+
+static RECORDER wav, vgm;
+
+/* VGM timekeeping: the cycle of the last write, and time so far */
+static uint32_t vgm_cpu_hz, vgm_psg_hz, vgm_cycle;
+static uint64_t vgm_cycles, vgm_samples;
+
+static void put16 (uint8_t *p, unsigned v)
+{
+ p[0]=v&0xFF;
+ p[1]=(v>>8)&0xFF;
+}
+
+static void put32 (uint8_t *p, unsigned long v)
+{
+ put16(p, v&0xFFFF);
+ put16(p+2, (v>>16)&0xFFFF);
+}
+
+/* Start recording the sound, at rate samples a second, to filename. */
+int soundlog_wav_open (const char *filename, uint32_t rate)
+{
+ return recorder_wav_open(&wav, filename, rate);
+}
+
+void soundlog_wav_close (void)
+{
+ if (!wav.writer) return;
+
+ recorder_wav_close(&wav);
+ printf("Recorded %.1f seconds of sound", (double)wav.bytes/2/wav.rate);
+ if (wav.dropped)
+  printf(" (%lu samples dropped)", wav.dropped/2);
+ printf("\n");
+}
+
+int soundlog_wav_active (void)
+{
+ return wav.writer!=NULL;
+}
+
+/* Record n samples, from the audio thread. */
+void soundlog_samples (const int16_t *samples, int n)
+{
+ recorder_wav_put(&wav, samples, n);
+}
+
+/* VGM 1.51 header, with only the AY-3-8910 in it. */
+static void vgm_header (FILE *file, unsigned long bytes)
+{
+ uint8_t h[VGM_HEADER];
+
+ memset(h, 0, VGM_HEADER);
+ memcpy(h, "Vgm ", 4);
+ put32(h+0x04, VGM_HEADER+bytes-4);    /* to the end of the file */
+ put32(h+0x08, 0x151);
+ put32(h+0x18, (unsigned long)vgm_samples);
+ put32(h+0x24, 60);                    /* NTSC */
+ put32(h+0x34, VGM_HEADER-0x34);       /* to the data */
+ put32(h+0x74, vgm_psg_hz);
+ h[0x78]=0x00;                         /* AY8910 */
+ h[0x79]=0x01;                         /* legacy output */
+ fseek(file, 0, SEEK_SET);
+ fwrite(h, 1, VGM_HEADER, file);
+ fseek(file, 0, SEEK_END);
+}
+
+/* Wait, in the log, until the given cycle. */
+static void vgm_wait (uint32_t cycle)
+{
+ uint64_t due, n;
+ uint8_t cmd[3];
+
+ /*
+  * Time only goes forwards.  If the cycle count goes back (a reset starts
+  * it again from 0), carry on from the new count, adding no time.
+  */
+ if ((int32_t)(cycle-vgm_cycle)>0)
+  vgm_cycles+=cycle-vgm_cycle;
+ vgm_cycle=cycle;
+ due=vgm_cycles*VGM_RATE/vgm_cpu_hz;
+
+ while (vgm_samples<due)
+ {
+  n=due-vgm_samples;
+  if (n>65535) n=65535;
+  if (n==735)
+  {
+   cmd[0]=0x62;                        /* a 60th of a second */
+   recorder_put(&vgm, cmd, 1);
+  }
+  else if (n<=16)
+  {
+   cmd[0]=0x70+(uint8_t)(n-1);
+   recorder_put(&vgm, cmd, 1);
+  }
+  else
+  {
+   cmd[0]=0x61;
+   put16(cmd+1, (unsigned)n);
+   recorder_put(&vgm, cmd, 3);
+  }
+  vgm_samples+=n;
+ }
+}
+
+/*
+ * Start logging the PSG to filename, from the given cycle.  regs is what
+ * registers 0-13 hold now, which the log starts by setting.
+ */
+int soundlog_vgm_open (const char *filename, uint32_t cpu_clock,
+                       uint32_t psg_clock, uint32_t cycle,
+                       const uint8_t *regs)
+{
+ FILE *file;
+ uint8_t h[VGM_HEADER];
+ int r;
+
+ if (vgm.writer) return -1;
+
+ file=fopen(filename, "wb");
+ if (!file)
+ {
+  perror(filename);
+  return -1;
+ }
+ memset(h, 0, VGM_HEADER);
+ fwrite(h, 1, VGM_HEADER, file);
+
+ vgm_cpu_hz=cpu_clock;
+ vgm_psg_hz=psg_clock;
+ vgm_cycle=cycle;
+ vgm_cycles=vgm_samples=0;
+ if (recorder_start(&vgm, file))
+  return -1;
+
+ for (r=0; r<14; r++)
+  soundlog_vgm_write(cycle, r, regs[r]);
+ return 0;
+}
+
+void soundlog_vgm_close (uint32_t cycle)
+{
+ if (!vgm.writer) return;
+
+ vgm_wait(cycle);
+ recorder_stop(&vgm);
+ fputc(0x66, vgm.file);                /* end of data */
+ vgm_header(vgm.file, vgm.bytes+1);
+ fclose(vgm.file);
+ vgm.file=NULL;
+ printf("Logged %.1f seconds of PSG writes", (double)vgm_samples/VGM_RATE);
+ if (vgm.dropped)
+  printf(" (%lu bytes dropped; the log will be wrong)", vgm.dropped);
+ printf("\n");
+}
+
+int soundlog_vgm_active (void)
+{
+ return vgm.writer!=NULL;
+}
+
+/* The CPU wrote val to PSG register reg on the given cycle. */
+void soundlog_vgm_write (uint32_t cycle, uint8_t reg, uint8_t val)
+{
+ uint8_t cmd[3];
+
+ if ((!SDL_AtomicGet(&vgm.on))||(reg>13)) return;
+
+ vgm_wait(cycle);
+ cmd[0]=0xA0;                          /* AY8910 write */
+ cmd[1]=reg;
+ cmd[2]=val;
+ recorder_put(&vgm, cmd, 3);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef H_SOUNDLOG
+#define H_SOUNDLOG
+
+#include <stdint.h>
+
+int soundlog_wav_open (const char *filename, uint32_t rate);
+void soundlog_wav_close (void);
+int soundlog_wav_active (void);
+void soundlog_samples (const int16_t *samples, int n);
+
+int soundlog_vgm_open (const char *filename, uint32_t cpu_clock,
+                       uint32_t psg_clock, uint32_t cycle,
+                       const uint8_t *regs);
+void soundlog_vgm_close (uint32_t cycle);
+int soundlog_vgm_active (void);
+void soundlog_vgm_write (uint32_t cycle, uint8_t reg, uint8_t val);
+
+#endif /* H_SOUNDLOG */
@@ -0,0 +1,372 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Terminal frontend (-t).
+ *
+ * In text mode, and in most Graphics I screens, everything worth seeing is
+ * characters in the name table.  So instead of drawing pixels, read the
+ * name table each frame and draw it as text on an ANSI terminal, touching
+ * only the cells that changed, in the nearest of the xterm 256 colors.
+ * Keys are read from the same terminal.  This is enough to run CP/M over
+ * an SSH session for next to nothing.
+ *
+ * Characters outside printable ASCII are guessed at from their patterns:
+ * a blank one is a space, a solid one is an inverse space (the usual
+ * cursor), and one from the top half of the set is taken to be the inverse
+ * of the character 128 below it.  Sprites are not shown.
+ *
+ * Needs termios, so not available on Windows or MS-DOS.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "term.h"
+
+#if defined(_WIN32)||defined(__MSDOS__)
+int term_open (const uint32_t *palette, void (*key)(uint32_t keysym, int down))
+{
+ fprintf(stderr, "Terminal display is not supported here\n");
+ return -1;
+}
+
+void term_close (void)
+{
+}
+
+int term_frame (VrEmuTms9918 *vdp)
+{
+ return 0;
+}
+#else
+#include <termios.h>
+#include <unistd.h>
+
+#define ROWS 24
+#define MAX_COLS 40
+#define SHOWN_NONE 0xFFFFFFFFUL
+
+static struct termios saved;
+static int up;
+static void (*key_handler)(uint32_t keysym, int down);
+static uint8_t xterm[16];
+
+/* What the terminal shows, as character << 16 | fg << 8 | bg */
+static uint32_t shown[ROWS][MAX_COLS];
+static int shown_cols, shown_mode;
+
+static char out[65536];
+static int outlen;
+
+static void emit (const char *fmt, ...)
+{
+ va_list ap;
+ int e;
+
+ va_start(ap, fmt);
+ e=vsnprintf(out+outlen, sizeof(out)-outlen, fmt, ap);
+ va_end(ap);
+ if ((e>0)&&(outlen+e<(int)sizeof(out))) outlen+=e;
+}
+
+/* Nearest step of the xterm 6x6x6 color cube */
+static int cube (int v)
+{
+ static const int level[6]={0, 95, 135, 175, 215, 255};
+ int i;
+
+ for (i=0; i<5; i++)
+  if (v<(level[i]+level[i+1])/2) break;
+ return i;
+}
+
+static void press (uint32_t sym)
+{
+ key_handler(sym, 1);
+ key_handler(sym, 0);
+}
+
+/* Control characters come in as Ctrl plus the matching key */
+static void press_ctrl (uint32_t sym)
+{
+ key_handler(0xFFE3, 1);
+ press(sym);
+ key_handler(0xFFE3, 0);
+}
+
+/*
+ * Read whatever has been typed and pass it on as keysyms.  Returns 1 if
+ * F10 (quit) was pressed.
+ */
+static int read_keys (void)
+{
+ uint8_t buf[64];
+ int n, i, arg;
+
+ n=read(0, buf, sizeof(buf));
+ for (i=0; i<n; i++)
+ {
+  uint8_t c=buf[i];
+
+  if ((c==0x1B)&&(i+2<n)&&((buf[i+1]=='[')||(buf[i+1]=='O')))
+  {
+   /* A cursor or function key */
+   for (arg=0, i+=2; (i<n)&&(buf[i]>='0')&&(buf[i]<='9'); i++)
+    arg=arg*10+buf[i]-'0';
+   while ((i<n)&&(buf[i]<0x40)) i++; /* modifiers; don't care */
+   if (i==n) break;
+   switch (buf[i])
+   {
+    case 'A': press(0xFF52); break;
+    case 'B': press(0xFF54); break;
+    case 'C': press(0xFF53); break;
+    case 'D': press(0xFF51); break;
+    case 'F': press(0xFF57); break;
+    case '~':
+     switch (arg)
+     {
+      case 2: press(0xFF63); break; /* Insert: YES */
+      case 3: press(0xFFFF); break; /* Delete: NO */
+      case 4:
+      case 8: press(0xFF57); break; /* End */
+      case 5: press(0xFF55); break; /* Page Up: « */
+      case 6: press(0xFF56); break; /* Page Down: » */
+      case 21: return 1;            /* F10 */
+     }
+     break;
+   }
+   continue;
+  }
+
+  switch (c)
+  {
+   case 0x08:
+   case 0x7F: press(0xFF08); break;
+   case 0x09: press(0xFF09); break;
+   case 0x0D: press(0xFF0D); break;
+   case 0x1B: press(0xFF1B); break;
+   default:
+    if (c<0x20)
+     press_ctrl(c+0x40);
+    else if (c<0x7F)
+     press(c);
+    /* and anything over $7F is UTF-8 we can't type anyway */
+  }
+ }
+ return 0;
+}
+
+/*
+ * Work out what to show for name table entry c, whose pattern is at pat,
+ * in colors fg and bg.  The mask is the part of each pattern byte that
+ * is displayed.
+ */
+static uint32_t cell (VrEmuTms9918 *vdp, int c, uint16_t pat, uint8_t mask,
+                      int fg, int bg)
+{
+ int i, bits;
+
+ if ((c>=0x20)&&(c<0x7F))
+  return (c<<16)|(fg<<8)|bg;
+
+ for (bits=i=0; i<8; i++)
+ {
+  uint8_t p=vrEmuTms9918VramValue(vdp, pat+i)&mask;
+
+  if (p==mask)
+   bits+=2;
+  else if (p)
+   bits++;
+ }
+ if (!bits)
+  return (' '<<16)|(fg<<8)|bg;
+ if (bits==16)
+  return (' '<<16)|(bg<<8)|fg;
+ c&=0x7F;
+ if ((c>=0x20)&&(c<0x7F))
+  return (c<<16)|(bg<<8)|fg;
+ return ('.'<<16)|(fg<<8)|bg;
+}
+
+/*
+ * Bring the terminal up to date with the VDP, and read keys.  Called once
+ * per frame.  Returns 1 if the user asked to quit.
+ */
+int term_frame (VrEmuTms9918 *vdp)
+{
+ uint8_t r0, r1, r7;
+ uint16_t nt, pt, ct;
+ int mode, cols, x, y, cx, cy, colors, backdrop;
+
+ if (!up) return 0;
+ if (read_keys()) return 1;
+
+ r0=vrEmuTms9918RegValue(vdp, TMS_REG_0);
+ r1=vrEmuTms9918RegValue(vdp, TMS_REG_1);
+ r7=vrEmuTms9918RegValue(vdp, TMS_REG_FG_BG_COLOR);
+ backdrop=(r7&0x0F)?(r7&0x0F):TMS_BLACK;
+
+ /* M1 is text, M2 multicolor, M3 Graphics II; blanked counts as its own */
+ if (!(r1&0x40))
+  mode=-1;
+ else if (r1&0x10)
+  mode=TMS_MODE_TEXT;
+ else if (r1&0x08)
+  mode=TMS_MODE_MULTICOLOR;
+ else if (r0&0x02)
+  mode=TMS_MODE_GRAPHICS_II;
+ else
+  mode=TMS_MODE_GRAPHICS_I;
+ cols=(mode==TMS_MODE_TEXT)?40:32;
+
+ if ((mode!=shown_mode)||(cols!=shown_cols))
+ {
+  emit("\033[0m\033[H\033[2J");
+  if (mode==TMS_MODE_MULTICOLOR)
+   emit("\033[12;8H(multicolor graphics)");
+  memset(shown, 0xFF, sizeof(shown));
+  shown_mode=mode;
+  shown_cols=cols;
+ }
+
+ nt=(vrEmuTms9918RegValue(vdp, TMS_REG_NAME_TABLE)&0x0F)<<10;
+ ct=vrEmuTms9918RegValue(vdp, TMS_REG_COLOR_TABLE)<<6;
+ pt=(vrEmuTms9918RegValue(vdp, TMS_REG_PATTERN_TABLE)&0x07)<<11;
+ if (mode==TMS_MODE_GRAPHICS_II)
+ {
+  ct&=0x2000;
+  pt&=0x2000;
+ }
+
+ cx=cy=-1;
+ colors=-1;
+ for (y=0; (y<ROWS)&&(mode!=TMS_MODE_MULTICOLOR); y++)
+  for (x=0; x<cols; x++)
+  {
+   uint32_t v;
+   int c, fg, bg;
+
+   c=vrEmuTms9918VramValue(vdp, nt+y*cols+x);
+   switch (mode)
+   {
+    case TMS_MODE_TEXT:
+     fg=r7>>4;
+     bg=backdrop;
+     v=cell(vdp, c, pt+c*8, 0xFC, fg?fg:bg, bg);
+     break;
+    case TMS_MODE_GRAPHICS_I:
+    case TMS_MODE_GRAPHICS_II:
+    {
+     uint16_t o=c*8;
+
+     if (mode==TMS_MODE_GRAPHICS_I)
+     {
+      fg=vrEmuTms9918VramValue(vdp, ct+(c>>3));
+     }
+     else
+     {
+      o+=(y>>3)<<11;
+      fg=vrEmuTms9918VramValue(vdp, ct+o);
+     }
+     bg=(fg&0x0F)?(fg&0x0F):backdrop;
+     fg=(fg>>4)?(fg>>4):backdrop;
+     v=cell(vdp, c, pt+o, 0xFF, fg, bg);
+     break;
+    }
+    default:
+     v=(' '<<16)|(backdrop<<8)|backdrop;
+   }
+
+   if (v==shown[y][x]) continue;
+   shown[y][x]=v;
+
+   if ((x!=cx)||(y!=cy))
+    emit("\033[%d;%dH", y+1, x+1);
+   if ((int)(v&0xFFFF)!=colors)
+   {
+    colors=v&0xFFFF;
+    emit("\033[38;5;%d;48;5;%dm", xterm[(v>>8)&0x0F], xterm[v&0x0F]);
+   }
+   emit("%c", (int)(v>>16));
+   cx=x+1;
+   cy=y;
+  }
+
+ if (outlen)
+ {
+  fwrite(out, 1, outlen, stdout);
+  fflush(stdout);
+  outlen=0;
+ }
+ return 0;
+}
+
+/*
+ * Put the terminal in raw mode, on the alternate screen.  The palette is
+ * the emulator's ARGB one.  Returns 0 on success.
+ */
+int term_open (const uint32_t *palette, void (*key)(uint32_t keysym, int down))
+{
+ struct termios raw;
+ int i;
+
+ if (!isatty(0)||!isatty(1)||tcgetattr(0, &saved))
+ {
+  fprintf(stderr, "Terminal display needs a terminal\n");
+  return -1;
+ }
+ raw=saved;
+ raw.c_iflag&=~(BRKINT|ICRNL|INPCK|ISTRIP|IXON);
+ raw.c_lflag&=~(ECHO|ICANON|IEXTEN|ISIG);
+ raw.c_cc[VMIN]=0;
+ raw.c_cc[VTIME]=0;
+ if (tcsetattr(0, TCSAFLUSH, &raw))
+ {
+  perror("Terminal display");
+  return -1;
+ }
+
+ for (i=0; i<16; i++)
+  xterm[i]=16+36*cube((palette[i]>>16)&0xFF)+6*cube((palette[i]>>8)&0xFF)
+          +cube(palette[i]&0xFF);
+
+ key_handler=key;
+ shown_mode=-2;
+ up=1;
+ atexit(term_close);
+
+ printf("\033[?1049h\033[?25l");
+ fflush(stdout);
+ return 0;
+}
+
+void term_close (void)
+{
+ if (!up) return;
+ up=0;
+ printf("\033[0m\033[?25h\033[?1049l");
+ fflush(stdout);
+ tcsetattr(0, TCSAFLUSH, &saved);
+}
+#endif
@@ -25,6 +25,12 @@
 #include <memory.h>
 #include <math.h>
 
+/* x86 builds carry SSE2 and AVX2 pattern kernels, selected at run time */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TMS_X86_KERNELS
+#include <immintrin.h>
+#endif
+
 #define VRAM_SIZE (1 << 14) /* 16KB */
 
 #define GRAPHICS_NUM_COLS 32
@@ -40,12 +46,21 @@
 #define LAST_SPRITE_VPOS 0xD0
 #define MAX_SCANLINE_SPRITES 4
 
+#define TILE_CACHE_ROWS 0x1800 /* a GII pattern table */
+
 #define STATUS_INT 0x80
 #define STATUS_5S  0x40
 #define STATUS_COL 0x20
 
  /* PRIVATE DATA STRUCTURE
   * ---------------------------------------- */
+typedef struct
+{
+  int16_t hPos;
+  uint8_t color;
+  uint32_t bits;    /* pattern row, magnified, leftmost pixel in bit 31 */
+} tmsLineSprite;
+
 struct vrEmuTMS9918_s
 {
   uint8_t vram[VRAM_SIZE];
@@ -60,7 +75,41 @@ struct vrEmuTMS9918_s
 
   vrEmuTms9918Mode mode;
 
-  uint8_t rowSpriteBits[TMS9918_PIXELS_X];
+  /* derived from the registers by tmsUpdateDerived */
+  uint16_t nameAddr;
+  uint16_t patternAddr;
+  uint16_t colorAddr;
+  uint16_t spriteAttrAddr;
+  uint16_t spritePatternAddr;
+  uint16_t pageMask;        /* GII: the bits of y*32 that pick a third */
+  uint8_t pageNameMask;     /* GII: the bits of a name that are used */
+  uint8_t spriteSize;       /* 8 or 16 */
+  uint8_t spriteMag;        /* 0 or 1 */
+  bool displayEnabled;
+  uint8_t bgColor;          /* backdrop, black when blanked */
+  uint8_t fgColor;          /* text foreground, transparent resolved */
+
+  /* the sprites on each line, and what they do to the status register.
+     lines from spriteLinesFrom down are up to date */
+  int spriteLinesFrom;
+  uint8_t lineSpriteCount[TMS9918_PIXELS_Y];
+  tmsLineSprite lineSprites[TMS9918_PIXELS_Y][MAX_SCANLINE_SPRITES];
+  uint8_t lineStatus[TMS9918_PIXELS_Y];     /* or'ed in while 5S is clear */
+  bool lineCollision[TMS9918_PIXELS_Y];
+
+  /* command log, see vrEmuTms9918SetLog */
+  uint32_t* log;
+  int logSize;
+  int logLength;
+  bool logOverflow;
+
+  /* what has changed since vrEmuTms9918TakeDirty was last called */
+  uint8_t dirtyFlags;
+  uint32_t dirtyRows;
+
+  /* expanded pattern rows, by offset into the pattern table */
+  uint8_t tileRows[TILE_CACHE_ROWS][GRAPHICS_CHAR_WIDTH];
+  uint8_t tileValid[TILE_CACHE_ROWS];
 };
 
 
@@ -90,112 +139,431 @@ static vrEmuTms9918Mode tmsMode(VrEmuTms9918* tms9918)
 }
 
 
-/* Function:  tmsSpriteSize
+/* Function:  tmsUpdateDerived
   * --------------------
-  * sprite size (0 = 8x8, 1 = 16x16)
+  * recompute the table addresses, sprite geometry and colors that the
+  * renderers use, after a register has been written
   */
-static inline bool tmsSpriteSize(VrEmuTms9918* tms9918)
+static void tmsUpdateDerived(VrEmuTms9918* tms9918)
 {
-  return tms9918->registers[TMS_REG_1] & 0x02;
+  uint8_t* reg = tms9918->registers;
+  vrEmuTms9918Color fg;
+
+  tms9918->mode = tmsMode(tms9918);
+
+  tms9918->nameAddr = (reg[TMS_REG_2] & 0x0f) << 10;
+  tms9918->spriteAttrAddr = (reg[TMS_REG_5] & 0x7f) << 7;
+  tms9918->spritePatternAddr = (reg[TMS_REG_6] & 0x07) << 11;
+
+  if (tms9918->mode == TMS_MODE_GRAPHICS_II)
+  {
+    tms9918->colorAddr = (reg[TMS_REG_3] & 0x80) << 6;
+    tms9918->patternAddr = (reg[TMS_REG_4] & 0x04) << 11;
+  }
+  else
+  {
+    tms9918->colorAddr = reg[TMS_REG_3] << 6;
+    tms9918->patternAddr = (reg[TMS_REG_4] & 0x07) << 11;
+  }
+
+  /* each third of a GII screen has its own 2K of patterns and colors,
+     unless the table masks make them all share the first 8 patterns */
+  if ((reg[TMS_REG_4] & 0x03) != 0x03 || (reg[TMS_REG_3] & 0x7f) != 0x7f)
+  {
+    tms9918->pageMask = 0;
+    tms9918->pageNameMask = 0x07;
+  }
+  else
+  {
+    tms9918->pageMask = 0x1800;
+    tms9918->pageNameMask = 0xff;
+  }
+
+  tms9918->spriteSize = (reg[TMS_REG_1] & 0x02) ? 16 : 8;
+  tms9918->spriteMag = reg[TMS_REG_1] & 0x01;
+
+  tms9918->displayEnabled = reg[TMS_REG_1] & 0x40;
+  tms9918->bgColor = (tms9918->displayEnabled ? reg[TMS_REG_7] : TMS_BLACK) & 0x0f;
+
+  fg = (vrEmuTms9918Color)(reg[TMS_REG_7] >> 4);
+  tms9918->fgColor = (fg == TMS_TRANSPARENT) ? tms9918->bgColor : fg;
 }
 
-/* Function:  tmsSpriteMagnification
+/* Function:  tmsFgColor
   * --------------------
-  * sprite size (0 = 1x, 1 = 2x)
+  * foreground color
   */
-static inline bool tmsSpriteMag(VrEmuTms9918* tms9918)
+static inline uint8_t tmsFgColor(VrEmuTms9918* tms9918, uint8_t colorByte)
 {
-  return tms9918->registers[TMS_REG_1] & 0x01;
+  uint8_t c = colorByte >> 4;
+  return c == TMS_TRANSPARENT ? tms9918->bgColor : c;
 }
 
-/* Function:  tmsNameTableAddr
+/* Function:  tmsBgColor
   * --------------------
-  * name table base address
+  * background color
   */
-static inline uint16_t tmsNameTableAddr(VrEmuTms9918* tms9918)
+static inline uint8_t tmsBgColor(VrEmuTms9918* tms9918, uint8_t colorByte)
 {
-  return (tms9918->registers[TMS_REG_2] & 0x0f) << 10;
+  uint8_t c = colorByte & 0x0f;
+  return c == TMS_TRANSPARENT ? tms9918->bgColor : c;
 }
 
-/* Function:  tmsColorTableAddr
+
+/* Function:  tmsMarkAllDirty
   * --------------------
-  * color table base address
+  * everything on screen needs redrawing
   */
-static inline uint16_t tmsColorTableAddr(VrEmuTms9918* tms9918)
+static inline void tmsMarkAllDirty(VrEmuTms9918* tms9918, uint8_t flags)
 {
-  if (tms9918->mode == TMS_MODE_GRAPHICS_II)
-    return (tms9918->registers[TMS_REG_3] & 0x80) << 6;
-  return tms9918->registers[TMS_REG_3] << 6;
+  tms9918->dirtyFlags |= flags;
+  tms9918->dirtyRows = TMS_DIRTY_ALL_ROWS;
 }
 
-/* Function:  tmsPatternTableAddr
+/* Function:  tmsMarkVramDirty
   * --------------------
-  * pattern table base address
+  * note which tables (and character rows) a vram write touched
   */
-static inline uint16_t tmsPatternTableAddr(VrEmuTms9918* tms9918)
+static void tmsMarkVramDirty(VrEmuTms9918* tms9918, uint16_t addr)
 {
+  uint16_t offset;
+  int cols = (tms9918->mode == TMS_MODE_TEXT) ? TEXT_NUM_COLS : GRAPHICS_NUM_COLS;
+
+  offset = addr - tms9918->nameAddr;
+  if (offset < cols * GRAPHICS_NUM_ROWS)
+  {
+    tms9918->dirtyFlags |= TMS_DIRTY_NAME;
+    tms9918->dirtyRows |= 1u << (offset / cols);
+  }
+
   if (tms9918->mode == TMS_MODE_GRAPHICS_II)
-    return (tms9918->registers[TMS_REG_4] & 0x04) << 11;
-  return (tms9918->registers[TMS_REG_4] & 0x07) << 11;
+  {
+    /* each third of the screen has its own 2K of patterns and colors,
+       unless the table masks make them all share the first one */
+    bool shared = tms9918->pageMask == 0;
+    uint32_t thirdRows;
+
+    offset = addr - tms9918->patternAddr;
+    if (offset < 0x1800)
+    {
+      thirdRows = shared ? TMS_DIRTY_ALL_ROWS : 0xffu << ((offset >> 11) * 8);
+      tms9918->dirtyFlags |= TMS_DIRTY_PATTERN;
+      tms9918->dirtyRows |= thirdRows;
+    }
+
+    offset = addr - tms9918->colorAddr;
+    if (offset < 0x1800)
+    {
+      thirdRows = shared ? TMS_DIRTY_ALL_ROWS : 0xffu << ((offset >> 11) * 8);
+      tms9918->dirtyFlags |= TMS_DIRTY_COLOR;
+      tms9918->dirtyRows |= thirdRows;
+    }
+  }
+  else
+  {
+    offset = addr - tms9918->patternAddr;
+    if (offset < 0x800)
+    {
+      tmsMarkAllDirty(tms9918, TMS_DIRTY_PATTERN);
+    }
+
+    offset = addr - tms9918->colorAddr;
+    if (tms9918->mode == TMS_MODE_GRAPHICS_I && offset < GRAPHICS_NUM_COLS)
+    {
+      tmsMarkAllDirty(tms9918, TMS_DIRTY_COLOR);
+    }
+  }
+
+  if (tms9918->mode != TMS_MODE_TEXT)
+  {
+    offset = addr - tms9918->spriteAttrAddr;
+    if (offset < MAX_SPRITES * SPRITE_ATTR_BYTES)
+    {
+      tmsMarkAllDirty(tms9918, TMS_DIRTY_SPRITES);
+      tms9918->spriteLinesFrom = TMS9918_PIXELS_Y;
+    }
+
+    offset = addr - tms9918->spritePatternAddr;
+    if (offset < 0x800)
+    {
+      tmsMarkAllDirty(tms9918, TMS_DIRTY_SPRITES);
+      tms9918->spriteLinesFrom = TMS9918_PIXELS_Y;
+    }
+  }
 }
 
-/* Function:  tmsSpriteAttrTableAddr
+/* PATTERN EXPANSION KERNELS
+ * ----------------------------------------
+ * A pattern byte is turned into pixels by looking up an 8 byte mask (0xff
+ * where the pattern bit is set, leftmost pixel first) and blending the
+ * fg/bg colors through it in a single and/xor.  The renderers gather a
+ * whole row of pattern and color bytes first, then expand it in one call.
+ */
+
+#define TMS_REP8 0x0101010101010101ULL
+
+static uint8_t tmsPatternMask[256][8];
+
+/* expand tiles of 8 pixels, each with its own fg/bg color */
+typedef void (*tmsExpandTilesFn)(uint8_t* pixels, const uint8_t* patterns,
+                                 const uint8_t* fg, const uint8_t* bg, int tiles);
+
+static tmsExpandTilesFn tmsExpandTiles;
+
+/* Function:  tmsMask8
   * --------------------
-  * sprite attribute table base address
+  * mask for a pattern byte, one byte per pixel
   */
-static inline uint16_t tmsSpriteAttrTableAddr(VrEmuTms9918* tms9918)
+static inline uint64_t tmsMask8(uint8_t pattern)
 {
-  return (tms9918->registers[TMS_REG_5] & 0x7f) << 7;
+  uint64_t mask;
+  memcpy(&mask, tmsPatternMask[pattern], sizeof(mask));
+  return mask;
 }
 
-/* Function:  tmsSpritePatternTableAddr
+/* Function:  tmsBlend8
   * --------------------
-  * sprite pattern table base address
+  * 8 pixels of bg, with fg where the pattern byte is set
   */
-static inline uint16_t tmsSpritePatternTableAddr(VrEmuTms9918* tms9918)
+static inline uint64_t tmsBlend8(uint8_t pattern, uint64_t fg8, uint64_t bg8)
 {
-  return (tms9918->registers[TMS_REG_6] & 0x07) << 11;
+  return bg8 ^ ((fg8 ^ bg8) & tmsMask8(pattern));
 }
 
-/* Function:  tmsBgColor
+static void tmsExpandTilesScalar(uint8_t* pixels, const uint8_t* patterns,
+                                 const uint8_t* fg, const uint8_t* bg, int tiles)
+{
+  for (int i = 0; i < tiles; ++i)
+  {
+    uint64_t px = tmsBlend8(patterns[i], fg[i] * TMS_REP8, bg[i] * TMS_REP8);
+    memcpy(pixels + i * 8, &px, sizeof(px));
+  }
+}
+
+#ifdef TMS_X86_KERNELS
+
+__attribute__((target("sse2")))
+static void tmsExpandTilesSSE2(uint8_t* pixels, const uint8_t* patterns,
+                               const uint8_t* fg, const uint8_t* bg, int tiles)
+{
+  int i = 0;
+
+  for (; i + 2 <= tiles; i += 2)
+  {
+    __m128i m = _mm_unpacklo_epi64(
+                  _mm_loadl_epi64((const __m128i*)tmsPatternMask[patterns[i]]),
+                  _mm_loadl_epi64((const __m128i*)tmsPatternMask[patterns[i + 1]]));
+    __m128i f = _mm_set_epi64x((long long)(fg[i + 1] * TMS_REP8), (long long)(fg[i] * TMS_REP8));
+    __m128i b = _mm_set_epi64x((long long)(bg[i + 1] * TMS_REP8), (long long)(bg[i] * TMS_REP8));
+
+    _mm_storeu_si128((__m128i*)(pixels + i * 8),
+                     _mm_xor_si128(b, _mm_and_si128(_mm_xor_si128(f, b), m)));
+  }
+
+  tmsExpandTilesScalar(pixels + i * 8, patterns + i, fg + i, bg + i, tiles - i);
+}
+
+__attribute__((target("avx2")))
+static void tmsExpandTilesAVX2(uint8_t* pixels, const uint8_t* patterns,
+                               const uint8_t* fg, const uint8_t* bg, int tiles)
+{
+  int i = 0;
+
+  for (; i + 4 <= tiles; i += 4)
+  {
+    __m256i m = _mm256_set_epi64x((long long)tmsMask8(patterns[i + 3]), (long long)tmsMask8(patterns[i + 2]),
+                                  (long long)tmsMask8(patterns[i + 1]), (long long)tmsMask8(patterns[i]));
+    __m256i f = _mm256_set_epi64x((long long)(fg[i + 3] * TMS_REP8), (long long)(fg[i + 2] * TMS_REP8),
+                                  (long long)(fg[i + 1] * TMS_REP8), (long long)(fg[i] * TMS_REP8));
+    __m256i b = _mm256_set_epi64x((long long)(bg[i + 3] * TMS_REP8), (long long)(bg[i + 2] * TMS_REP8),
+                                  (long long)(bg[i + 1] * TMS_REP8), (long long)(bg[i] * TMS_REP8));
+
+    _mm256_storeu_si256((__m256i*)(pixels + i * 8),
+                        _mm256_xor_si256(b, _mm256_and_si256(_mm256_xor_si256(f, b), m)));
+  }
+
+  tmsExpandTilesScalar(pixels + i * 8, patterns + i, fg + i, bg + i, tiles - i);
+}
+
+#endif /* TMS_X86_KERNELS */
+
+/* Function:  tmsInitKernels
   * --------------------
-  * background color
+  * build the mask table and pick the best kernels for this cpu. this is
+  * done by the first vrEmuTms9918New, and tmsExpandTiles is only set once
+  * the table is ready, so later VDPs can be made and run on other threads
   */
-static inline vrEmuTms9918Color tmsMainBgColor(VrEmuTms9918* tms9918)
+static void tmsInitKernels(void)
 {
-  return (vrEmuTms9918Color)((vrEmuTms9918DisplayEnabled(tms9918) 
-            ? tms9918->registers[TMS_REG_7] 
-            : TMS_BLACK) & 0x0f);
+  tmsExpandTilesFn expand = tmsExpandTilesScalar;
+
+  if (tmsExpandTiles)
+    return;
+
+  for (int p = 0; p < 256; ++p)
+  {
+    for (int i = 0; i < 8; ++i)
+    {
+      tmsPatternMask[p][i] = (p & (0x80 >> i)) ? 0xff : 0x00;
+    }
+  }
+
+#ifdef TMS_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+  {
+    expand = tmsExpandTilesSSE2;
+  }
+  if (__builtin_cpu_supports("avx2"))
+  {
+    expand = tmsExpandTilesAVX2;
+  }
+#endif
+
+  tmsExpandTiles = expand;
 }
 
-/* Function:  tmsFgColor
+
+/* TILE CACHE
+ * ----------------------------------------
+ * In GI, GII and text modes each pattern row is expanded (with its fg/bg
+ * colors resolved) the first time it is drawn, keyed by its offset into the
+ * pattern table, and after that a scanline is just a gather of cached rows.
+ * A vram write drops the rows that depend on the byte written, a register
+ * write drops everything.
+ */
+
+/* Function:  tmsFlushTiles
   * --------------------
-  * foreground color
+  * forget every cached pattern row
   */
-static inline vrEmuTms9918Color tmsMainFgColor(VrEmuTms9918* tms9918)
+static inline void tmsFlushTiles(VrEmuTms9918* tms9918)
 {
-  vrEmuTms9918Color c = (vrEmuTms9918Color)(tms9918->registers[TMS_REG_7] >> 4);
-  return c == TMS_TRANSPARENT ? tmsMainBgColor(tms9918) : c;
+  memset(tms9918->tileValid, 0, sizeof(tms9918->tileValid));
 }
 
-/* Function:  tmsFgColor
+/* Function:  tmsInvalidateTiles
   * --------------------
-  * foreground color
+  * forget the cached pattern rows that a vram write affects
+  */
+static void tmsInvalidateTiles(VrEmuTms9918* tms9918, uint16_t addr)
+{
+  uint16_t offset;
+
+  switch (tms9918->mode)
+  {
+    case TMS_MODE_GRAPHICS_I:
+      offset = addr - tms9918->patternAddr;
+      if (offset < 0x800)
+      {
+        tms9918->tileValid[offset] = 0;
+      }
+
+      /* one color byte covers 8 patterns */
+      offset = addr - tms9918->colorAddr;
+      if (offset < GRAPHICS_NUM_COLS)
+      {
+        memset(tms9918->tileValid + offset * 64, 0, 64);
+      }
+      break;
+
+    case TMS_MODE_GRAPHICS_II:
+      /* a color byte for every pattern byte */
+      offset = addr - tms9918->patternAddr;
+      if (offset < TILE_CACHE_ROWS)
+      {
+        tms9918->tileValid[offset] = 0;
+      }
+
+      offset = addr - tms9918->colorAddr;
+      if (offset < TILE_CACHE_ROWS)
+      {
+        tms9918->tileValid[offset] = 0;
+      }
+      break;
+
+    case TMS_MODE_TEXT:
+      offset = addr - tms9918->patternAddr;
+      if (offset < 0x800)
+      {
+        tms9918->tileValid[offset] = 0;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+/* Function:  tmsFillTiles
+  * --------------------
+  * expand missing pattern rows into the cache
   */
-static inline vrEmuTms9918Color tmsFgColor(VrEmuTms9918* tms9918, uint8_t colorByte)
+static void tmsFillTiles(VrEmuTms9918* tms9918, const uint16_t* keys, const uint8_t* patterns,
+                         const uint8_t* fg, const uint8_t* bg, int tiles)
 {
-  vrEmuTms9918Color c = (vrEmuTms9918Color)(colorByte >> 4);
-  return c == TMS_TRANSPARENT ? tmsMainBgColor(tms9918) : c;
+  uint8_t expanded[TEXT_NUM_COLS * GRAPHICS_CHAR_WIDTH];
+
+  if (tiles == 0)
+    return;
+
+  tmsExpandTiles(expanded, patterns, fg, bg, tiles);
+
+  for (int i = 0; i < tiles; ++i)
+  {
+    memcpy(tms9918->tileRows[keys[i]], expanded + i * GRAPHICS_CHAR_WIDTH, GRAPHICS_CHAR_WIDTH);
+  }
 }
 
-/* Function:  tmsBgColor
+/* Function:  tmsGatherTiles
   * --------------------
-  * background color
+  * copy cached pattern rows to a scanline, stride pixels apart.
+  * all 8 bytes are copied, so a stride under 8 leaves slack past the end
   */
-static inline vrEmuTms9918Color tmsBgColor(VrEmuTms9918* tms9918, uint8_t colorByte)
+static void tmsGatherTiles(VrEmuTms9918* tms9918, uint8_t* pixels, int stride,
+                           const uint16_t* keys, int tiles)
 {
-  vrEmuTms9918Color c = (vrEmuTms9918Color)(colorByte & 0x0f);
-  return c == TMS_TRANSPARENT ? tmsMainBgColor(tms9918) : c;
+  for (int i = 0; i < tiles; ++i)
+  {
+    memcpy(pixels + i * stride, tms9918->tileRows[keys[i]], GRAPHICS_CHAR_WIDTH);
+  }
+}
+
+
+/* Function:  tmsLog
+  * --------------------
+  * record a command, if anyone is listening
+  */
+static inline void tmsLog(VrEmuTms9918* tms9918, uint32_t entry)
+{
+  if (tms9918->log == NULL)
+    return;
+
+  if (tms9918->logLength < tms9918->logSize)
+  {
+    tms9918->log[tms9918->logLength++] = entry;
+  }
+  else
+  {
+    tms9918->logOverflow = true;
+  }
+}
+
+/* Function:  tmsWriteRegister
+  * --------------------
+  * set a register, marking the screen dirty if it changed
+  */
+static void tmsWriteRegister(VrEmuTms9918* tms9918, uint8_t reg, uint8_t value)
+{
+  if (tms9918->registers[reg] != value)
+  {
+    tmsMarkAllDirty(tms9918, TMS_DIRTY_REGS);
+    tmsFlushTiles(tms9918);
+    tms9918->spriteLinesFrom = TMS9918_PIXELS_Y;
+  }
+
+  tms9918->registers[reg] = value;
+  tmsUpdateDerived(tms9918);
 }
 
 
@@ -206,8 +574,12 @@ static inline vrEmuTms9918Color tmsBgColor(VrEmuTms9918* tms9918, uint8_t colorB
  VrEmuTms9918* vrEmuTms9918New()
 {
   VrEmuTms9918* tms9918 = (VrEmuTms9918*)malloc(sizeof(VrEmuTms9918));
+
+  tmsInitKernels();
+
   if (tms9918 != NULL)
   {
+    tms9918->log = NULL;
     vrEmuTms9918Reset(tms9918);
  }
 
@@ -222,12 +594,19 @@ static inline vrEmuTms9918Color tmsBgColor(VrEmuTms9918* tms9918, uint8_t colorB
 {
   if (tms9918)
   {
+    tmsLog(tms9918, TMS_LOG_RESET);
+
     /* initialization */
     tms9918->currentAddress = 0;
     tms9918->lastMode = 0;
     tms9918->status = 0;
     memset(tms9918->registers, 0, sizeof(tms9918->registers));
     memset(tms9918->vram, 0xff, sizeof(tms9918->vram));
+    tmsUpdateDerived(tms9918);
+    tmsFlushTiles(tms9918);
+    tms9918->spriteLinesFrom = TMS9918_PIXELS_Y;
+    tmsMarkAllDirty(tms9918, TMS_DIRTY_NAME | TMS_DIRTY_PATTERN | TMS_DIRTY_COLOR |
+                             TMS_DIRTY_SPRITES | TMS_DIRTY_REGS);
   }
 }
 
@@ -255,15 +634,15 @@ static inline vrEmuTms9918Color tmsBgColor(VrEmuTms9918* tms9918, uint8_t colorB
  */
  void vrEmuTms9918WriteAddr(VrEmuTms9918* tms9918, uint8_t data)
 {
+  tmsLog(tms9918, TMS_LOG_ADDR | data);
+
   if (tms9918->lastMode)
   {
     /* second address byte */
 
     if (data & 0x80) /* register */
     {
-      tms9918->registers[data & 0x07] = tms9918->currentAddress & 0xff;
-
-      tms9918->mode = tmsMode(tms9918);
+      tmsWriteRegister(tms9918, data & 0x07, tms9918->currentAddress & 0xff);
     }
     else /* address */
     {
@@ -286,7 +665,17 @@ static inline vrEmuTms9918Color tmsBgColor(VrEmuTms9918* tms9918, uint8_t colorB
  */
  void vrEmuTms9918WriteData(VrEmuTms9918* tms9918, uint8_t data)
 {
-  tms9918->vram[(tms9918->currentAddress++) & 0x3fff] = data;
+  uint16_t addr = (tms9918->currentAddress++) & 0x3fff;
+
+  tmsLog(tms9918, TMS_LOG_DATA | data);
+
+  /* rewriting the same value changes nothing on screen */
+  if (tms9918->vram[addr] != data)
+  {
+    tms9918->vram[addr] = data;
+    tmsMarkVramDirty(tms9918, addr);
+    tmsInvalidateTiles(tms9918, addr);
+  }
 }
 
 /* Function:  vrEmuTms9918ReadStatus
@@ -306,6 +695,7 @@ static inline vrEmuTms9918Color tmsBgColor(VrEmuTms9918* tms9918, uint8_t colorB
  */
  uint8_t vrEmuTms9918ReadData(VrEmuTms9918* tms9918)
 {
+  tmsLog(tms9918, TMS_LOG_READ);
   return tms9918->vram[(tms9918->currentAddress++) & 0x3fff];
 }
 
@@ -318,22 +708,38 @@ static inline vrEmuTms9918Color tmsBgColor(VrEmuTms9918* tms9918, uint8_t colorB
   return tms9918->vram[tms9918->currentAddress & 0x3fff];
 }
 
-/* Function:  vrEmuTms9918OutputSprites
+/* Function:  tmsOnScreenBits
  * ----------------------------------------
- * Output Sprites to a scanline
+ * which of the 64 pixels from x onwards (leftmost in bit 63) are on screen
  */
-static void vrEmuTms9918OutputSprites(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+static inline uint64_t tmsOnScreenBits(int x)
 {
-  int spriteSizePx = (tmsSpriteSize(tms9918) ? 16 : 8) * (tmsSpriteMag(tms9918) ? 2 : 1);
-  uint16_t spriteAttrTableAddr = tmsSpriteAttrTableAddr(tms9918);
-  uint16_t spritePatternAddr = tmsSpritePatternTableAddr(tms9918);
+  int first = x < 0 ? -x : 0;
+  int last = TMS9918_PIXELS_X - 1 - x;
 
-  int spritesShown = 0;
+  if (last > 63)
+    last = 63;
+  if (first > last)
+    return 0;
 
-  if (y == 0)
-  {
-    tms9918->status = 0;
-  }
+  return (~0ULL >> first) & (~0ULL << (63 - last));
+}
+
+/* Function:  tmsBuildSpriteLines
+ * ----------------------------------------
+ * bucket the sprites by scanline, from line y down, and work out the
+ * 5th sprite and collision status for each of those lines
+ */
+static void tmsBuildSpriteLines(VrEmuTms9918* tms9918, uint8_t y)
+{
+  int spriteSize = tms9918->spriteSize;
+  int mag = tms9918->spriteMag;
+  uint16_t spriteAttrTableAddr = tms9918->spriteAttrAddr;
+  uint16_t spritePatternAddr = tms9918->spritePatternAddr;
+
+  memset(tms9918->lineSpriteCount + y, 0, TMS9918_PIXELS_Y - y);
+  memset(tms9918->lineStatus + y, 0, TMS9918_PIXELS_Y - y);
+  memset(tms9918->lineCollision + y, 0, (TMS9918_PIXELS_Y - y) * sizeof(bool));
 
   for (int i = 0; i < MAX_SPRITES; ++i)
   {
@@ -341,12 +747,16 @@ static void vrEmuTms9918OutputSprites(VrEmuTms9918* tms9918, uint8_t y, uint8_t
 
     int vPos = tms9918->vram[spriteAttrAddr];
 
-    /* stop processing when vPos == LAST_SPRITE_VPOS */
+    /* stop processing when vPos == LAST_SPRITE_VPOS. lines which already
+       found a 5th sprite never got this far */
     if (vPos == LAST_SPRITE_VPOS)
     {
-      if ((tms9918->status & STATUS_5S) == 0)
+      for (int line = y; line < TMS9918_PIXELS_Y; ++line)
       {
-        tms9918->status |= i;
+        if ((tms9918->lineStatus[line] & STATUS_5S) == 0)
+        {
+          tms9918->lineStatus[line] = i;
+        }
       }
       break;
     }
@@ -359,86 +769,147 @@ static void vrEmuTms9918OutputSprites(VrEmuTms9918* tms9918, uint8_t y, uint8_t
 
     vPos += 1;
 
-    int patternRow = y - vPos;
-    if (tmsSpriteMag(tms9918))
-    {
-      patternRow /= 2;
-    }
-
-    /* check if sprite is visible on this line */
-    if (patternRow < 0 || patternRow >= (tmsSpriteSize(tms9918) ? 16 : 8))
-      continue;
-
-    vrEmuTms9918Color spriteColor = tms9918->vram[spriteAttrAddr + 3] & 0x0f;
-
-    if (spritesShown == 0)
-    {
-      /* if we're showing the first sprite, clear the bit buffer */
-      memset(tms9918->rowSpriteBits, 0, TMS9918_PIXELS_X);
-    }
-
-    /* have we exceeded the scanline sprite limit? */
-    if (++spritesShown > MAX_SCANLINE_SPRITES)
+    /* rows are halved towards zero when magnified, so the line above
+       vPos shows row 0 as well */
+    int first = vPos - mag > y ? vPos - mag : y;
+    int end = vPos + (spriteSize << mag);
+    if (end > TMS9918_PIXELS_Y)
     {
-      if ((tms9918->status & STATUS_5S) == 0)
-      {
-        tms9918->status |= STATUS_5S | i;
-      }
-      break;
+      end = TMS9918_PIXELS_Y;
     }
 
-    /* sprite is visible on this line */
     uint8_t patternName = tms9918->vram[spriteAttrAddr + 2];
-
-    uint16_t patternOffset = spritePatternAddr + patternName * 8 + (uint16_t)patternRow;
-
     int hPos = tms9918->vram[spriteAttrAddr + 1];
     if (tms9918->vram[spriteAttrAddr + 3] & 0x80)  /* check early clock bit */
     {
       hPos -= 32;
     }
 
-    uint8_t patternByte = tms9918->vram[patternOffset];
+    for (int line = first; line < end; ++line)
+    {
+      int count = tms9918->lineSpriteCount[line];
 
-    int screenBit  = 0;
-    int patternBit = 0;
+      if (tms9918->lineStatus[line] & STATUS_5S)
+        continue;
 
-    for (int screenX = hPos; screenX < (hPos + spriteSizePx); ++screenX, ++screenBit)
-    {
-      if (screenX >= TMS9918_PIXELS_X)
+      /* have we exceeded the scanline sprite limit? */
+      if (count == MAX_SCANLINE_SPRITES)
       {
-        break;
+        tms9918->lineStatus[line] = STATUS_5S | i;
+        continue;
       }
 
-      if (screenX >= 0)
+      /* sprite is visible on this line */
+      int patternRow = line - vPos;
+      if (mag)
       {
-        if (patternByte & (0x80 >> patternBit))
-        {
-          /* we still process transparent sprites, since they're used in 5S and collistion checks */
-          if (spriteColor != TMS_TRANSPARENT)
-          {
-            pixels[screenX] = spriteColor;
-          }
+        patternRow /= 2;
+      }
+
+      uint16_t patternOffset = spritePatternAddr + patternName * 8 + (uint16_t)patternRow;
+      uint32_t bits = (uint32_t)tms9918->vram[patternOffset] << 24;
+      if (spriteSize == 16)
+      {
+        bits |= (uint32_t)tms9918->vram[patternOffset + 16] << 16;
+      }
 
-          if (tms9918->rowSpriteBits[screenX])
+      if (mag)
+      {
+        uint32_t wide = 0;
+        for (int b = 0; b < 16; ++b)
+        {
+          if (bits & (0x80000000u >> b))
           {
-            tms9918->status |= STATUS_COL;
+            wide |= 0xc0000000u >> (b * 2);
           }
-          tms9918->rowSpriteBits[screenX] = 1;
         }
+        bits = wide;
       }
 
-      if (!tmsSpriteMag(tms9918) || (screenBit & 0x01))
+      tmsLineSprite* sprite = &tms9918->lineSprites[line][count];
+      sprite->hPos = hPos;
+      sprite->color = tms9918->vram[spriteAttrAddr + 3] & 0x0f;
+      sprite->bits = bits;
+
+      /* we still process transparent sprites, since they're used in 5S and
+         collision checks. only pixels that are on screen can collide */
+      uint64_t mine = ((uint64_t)bits << 32) & tmsOnScreenBits(hPos);
+      for (int j = 0; j < count && !tms9918->lineCollision[line]; ++j)
       {
-        if (++patternBit == 8) /* from A -> C or B -> D of large sprite */
+        int dx = tms9918->lineSprites[line][j].hPos - hPos;
+        uint64_t theirs = (uint64_t)tms9918->lineSprites[line][j].bits << 32;
+
+        if (dx <= -32 || dx >= 32)
+          continue;
+
+        theirs = dx < 0 ? theirs << -dx : theirs >> dx;
+        if (mine & theirs)
         {
-          patternBit = 0;
-          patternByte = tms9918->vram[patternOffset + 16];
+          tms9918->lineCollision[line] = true;
         }
       }
-    }    
+
+      tms9918->lineSpriteCount[line] = count + 1;
+    }
+  }
+
+  tms9918->spriteLinesFrom = y;
+}
+
+/* Function:  vrEmuTms9918SpriteStatus
+ * ----------------------------------------
+ * update the status register for the sprites on a scanline
+ */
+static void vrEmuTms9918SpriteStatus(VrEmuTms9918* tms9918, uint8_t y)
+{
+  if (y == 0)
+  {
+    tms9918->status = 0;
+  }
+
+  if (y < tms9918->spriteLinesFrom)
+  {
+    tmsBuildSpriteLines(tms9918, y);
+  }
+
+  if ((tms9918->status & STATUS_5S) == 0)
+  {
+    tms9918->status |= tms9918->lineStatus[y];
+  }
+
+  if (tms9918->lineCollision[y])
+  {
+    tms9918->status |= STATUS_COL;
+  }
+}
+
+/* Function:  vrEmuTms9918OutputSprites
+ * ----------------------------------------
+ * Output Sprites to a scanline
+ */
+static void vrEmuTms9918OutputSprites(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+{
+  if (y < tms9918->spriteLinesFrom)
+  {
+    tmsBuildSpriteLines(tms9918, y);
   }
 
+  for (int i = 0; i < tms9918->lineSpriteCount[y]; ++i)
+  {
+    const tmsLineSprite* sprite = &tms9918->lineSprites[y][i];
+    uint32_t bits = sprite->bits;
+
+    if (sprite->color == TMS_TRANSPARENT)
+      continue;
+
+    for (int screenX = sprite->hPos; bits; ++screenX, bits <<= 1)
+    {
+      if ((bits & 0x80000000u) && screenX >= 0 && screenX < TMS9918_PIXELS_X)
+      {
+        pixels[screenX] = sprite->color;
+      }
+    }
+  }
 }
 
 
@@ -451,31 +922,40 @@ static void vrEmuTms9918GraphicsIScanLine(VrEmuTms9918* tms9918, uint8_t y, uint
   uint8_t textRow = y >> 3;
   int patternRow = y % 8;
 
-  uint16_t namesAddr = tmsNameTableAddr(tms9918) + textRow * GRAPHICS_NUM_COLS;
+  uint16_t namesAddr = tms9918->nameAddr + textRow * GRAPHICS_NUM_COLS;
 
-  uint16_t patternBaseAddr = tmsPatternTableAddr(tms9918);
-  uint16_t colorBaseAddr = tmsColorTableAddr(tms9918);
+  uint16_t patternBaseAddr = tms9918->patternAddr;
+  uint16_t colorBaseAddr = tms9918->colorAddr;
 
-  int pixelIndex = -1;
+  uint16_t keys[GRAPHICS_NUM_COLS];
+  uint16_t missKeys[GRAPHICS_NUM_COLS];
+  uint8_t patternBytes[GRAPHICS_NUM_COLS];
+  uint8_t fgColors[GRAPHICS_NUM_COLS];
+  uint8_t bgColors[GRAPHICS_NUM_COLS];
+  int misses = 0;
 
   for (int tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
   {
     int pattern = tms9918->vram[namesAddr + tileX];
-    
-    uint8_t patternByte = tms9918->vram[patternBaseAddr + pattern * 8 + patternRow];
+    uint16_t key = pattern * 8 + patternRow;
 
-    uint8_t colorByte = tms9918->vram[colorBaseAddr + pattern / 8];
+    keys[tileX] = key;
+    if (tms9918->tileValid[key])
+      continue;
+    tms9918->tileValid[key] = 1;
 
-    vrEmuTms9918Color fgColor = tmsFgColor(tms9918, colorByte);
-    vrEmuTms9918Color bgColor = tmsBgColor(tms9918, colorByte);
+    patternBytes[misses] = tms9918->vram[patternBaseAddr + key];
 
-    for (int i = 0; i < GRAPHICS_CHAR_WIDTH; ++i)
-    {
-      pixels[++pixelIndex] = (uint8_t)((patternByte & 0x80) ? fgColor : bgColor);
-      patternByte <<= 1;
-    }
+    uint8_t colorByte = tms9918->vram[colorBaseAddr + pattern / 8];
+
+    fgColors[misses] = tmsFgColor(tms9918, colorByte);
+    bgColors[misses] = tmsBgColor(tms9918, colorByte);
+    missKeys[misses++] = key;
   }
 
+  tmsFillTiles(tms9918, missKeys, patternBytes, fgColors, bgColors, misses);
+  tmsGatherTiles(tms9918, pixels, GRAPHICS_CHAR_WIDTH, keys, GRAPHICS_NUM_COLS);
+
   vrEmuTms9918OutputSprites(tms9918, y, pixels);
 }
 
@@ -488,46 +968,43 @@ static void vrEmuTms9918GraphicsIIScanLine(VrEmuTms9918* tms9918, uint8_t y, uin
   uint8_t textRow = y >> 3;
   int patternRow = y % 8;
 
-  uint16_t namesAddr = tmsNameTableAddr(tms9918) + textRow * GRAPHICS_NUM_COLS;
-
-  int pageThird = (textRow & 0x18) >> 3; /* which page? 0-2 */
-  uint16_t pageOffset = pageThird << 11;       /* offset (0, 0x800 or 0x1000) */
+  uint16_t namesAddr = tms9918->nameAddr + textRow * GRAPHICS_NUM_COLS;
 
-  bool invalidGfxII = (tms9918->registers[TMS_REG_4] & 0x03) != 0x03 ||
-                      (tms9918->registers[TMS_REG_3] & 0x7f) != 0x7f;
-
-  if (invalidGfxII)
-  {
-    pageOffset = 0;
-  }
+  /* offset of this third's patterns and colors (0, 0x800 or 0x1000) */
+  uint16_t pageOffset = (textRow << 8) & tms9918->pageMask;
 
-  uint16_t patternBaseAddr = tmsPatternTableAddr(tms9918) + pageOffset;
-  uint16_t colorBaseAddr = tmsColorTableAddr(tms9918) + pageOffset;
+  uint16_t patternBaseAddr = tms9918->patternAddr + pageOffset;
+  uint16_t colorBaseAddr = tms9918->colorAddr + pageOffset;
 
-  int pixelIndex = -1;
+  uint16_t keys[GRAPHICS_NUM_COLS];
+  uint16_t missKeys[GRAPHICS_NUM_COLS];
+  uint8_t patternBytes[GRAPHICS_NUM_COLS];
+  uint8_t fgColors[GRAPHICS_NUM_COLS];
+  uint8_t bgColors[GRAPHICS_NUM_COLS];
+  int misses = 0;
 
   for (int tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
   {
-    int pattern = tms9918->vram[namesAddr + tileX];
+    int pattern = tms9918->vram[namesAddr + tileX] & tms9918->pageNameMask;
 
-    if (invalidGfxII)
-    {
-      pattern &= 0x07;
-    }
+    uint16_t key = pageOffset + pattern * 8 + patternRow;
 
-    uint8_t patternByte = tms9918->vram[patternBaseAddr + pattern * 8 + patternRow];
-    uint8_t colorByte = tms9918->vram[colorBaseAddr + pattern * 8 + patternRow];
+    keys[tileX] = key;
+    if (tms9918->tileValid[key])
+      continue;
+    tms9918->tileValid[key] = 1;
 
-    vrEmuTms9918Color fgColor = tmsFgColor(tms9918, colorByte);
-    vrEmuTms9918Color bgColor = tmsBgColor(tms9918, colorByte);
+    patternBytes[misses] = tms9918->vram[patternBaseAddr + pattern * 8 + patternRow];
+    uint8_t colorByte = tms9918->vram[colorBaseAddr + pattern * 8 + patternRow];
 
-    for (int i = 0; i < GRAPHICS_CHAR_WIDTH; ++i)
-    {
-      pixels[++pixelIndex] = (uint8_t)((patternByte & 0x80) ? fgColor : bgColor);
-      patternByte <<= 1;
-    }
+    fgColors[misses] = tmsFgColor(tms9918, colorByte);
+    bgColors[misses] = tmsBgColor(tms9918, colorByte);
+    missKeys[misses++] = key;
   }
 
+  tmsFillTiles(tms9918, missKeys, patternBytes, fgColors, bgColors, misses);
+  tmsGatherTiles(tms9918, pixels, GRAPHICS_CHAR_WIDTH, keys, GRAPHICS_NUM_COLS);
+
   vrEmuTms9918OutputSprites(tms9918, y, pixels);
 }
 
@@ -540,37 +1017,45 @@ static void vrEmuTms9918TextScanLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t p
   uint8_t textRow = y >> 3;
   int patternRow = y % 8;
 
-  uint16_t namesAddr = tmsNameTableAddr(tms9918) + textRow * TEXT_NUM_COLS;
+  uint16_t namesAddr = tms9918->nameAddr + textRow * TEXT_NUM_COLS;
 
-  vrEmuTms9918Color bgColor = tmsMainBgColor(tms9918);
-  vrEmuTms9918Color fgColor = tmsMainFgColor(tms9918);
+  vrEmuTms9918Color bgColor = tms9918->bgColor;
+  vrEmuTms9918Color fgColor = tms9918->fgColor;
   
-  int pixelIndex = -1;
+  uint16_t patternBaseAddr = tms9918->patternAddr;
 
-  /* fill the first 8 pixels with bg color */
-  while (++pixelIndex < 8)
-  {
-    pixels[pixelIndex] = bgColor;
-  }
-  --pixelIndex;
+  uint16_t keys[TEXT_NUM_COLS];
+  uint16_t missKeys[TEXT_NUM_COLS];
+  uint8_t patternBytes[TEXT_NUM_COLS];
+  uint8_t fgColors[TEXT_NUM_COLS];
+  uint8_t bgColors[TEXT_NUM_COLS];
+  int misses = 0;
 
   for (int tileX = 0; tileX < TEXT_NUM_COLS; ++tileX)
   {
     int pattern = tms9918->vram[namesAddr + tileX];
+    uint16_t key = pattern * 8 + patternRow;
 
-    uint8_t patternByte = tms9918->vram[tmsPatternTableAddr(tms9918) + pattern * 8 + patternRow];
+    keys[tileX] = key;
+    if (tms9918->tileValid[key])
+      continue;
+    tms9918->tileValid[key] = 1;
 
-    for (int i = 0; i < TEXT_CHAR_WIDTH; ++i)
-    {
-      pixels[++pixelIndex] = (uint8_t)((patternByte & 0x80) ? fgColor : bgColor);
-      patternByte <<= 1;
-    }
+    patternBytes[misses] = tms9918->vram[patternBaseAddr + key];
+    fgColors[misses] = (uint8_t)fgColor;
+    bgColors[misses] = (uint8_t)bgColor;
+    missKeys[misses++] = key;
   }
 
-  while (++pixelIndex < TMS9918_PIXELS_X)
-  {
-    pixels[pixelIndex] = bgColor;
-  }
+  tmsFillTiles(tms9918, missKeys, patternBytes, fgColors, bgColors, misses);
+
+  /* 8 pixels of bg color either side of the 240 text pixels.
+     the gather's slack bytes land in the right border before it's filled */
+  const int textEnd = 8 + TEXT_NUM_COLS * TEXT_CHAR_WIDTH;
+
+  memset(pixels, bgColor, 8);
+  tmsGatherTiles(tms9918, pixels + 8, TEXT_CHAR_WIDTH, keys, TEXT_NUM_COLS);
+  memset(pixels + textEnd, bgColor, TMS9918_PIXELS_X - textEnd);
 }
 
 /* Function:  vrEmuTms9918MulticolorScanLine
@@ -582,36 +1067,46 @@ static void vrEmuTms9918MulticolorScanLine(VrEmuTms9918* tms9918, uint8_t y, uin
   uint8_t textRow = y >> 3;
   int patternRow = (y / 4) % 2 + (textRow % 4) * 2;
 
-  uint16_t namesAddr = tmsNameTableAddr(tms9918) + textRow * GRAPHICS_NUM_COLS;
+  uint16_t namesAddr = tms9918->nameAddr + textRow * GRAPHICS_NUM_COLS;
+
+  uint16_t patternBaseAddr = tms9918->patternAddr;
 
-  int pixelIndex = -1;
+  /* each tile is 4 pixels of the high nibble color, then 4 of the low */
+  static const uint8_t halves[GRAPHICS_NUM_COLS] = {
+    0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0,
+    0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0
+  };
+  uint8_t fgColors[GRAPHICS_NUM_COLS];
+  uint8_t bgColors[GRAPHICS_NUM_COLS];
 
   for (int tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
   {
     int pattern = tms9918->vram[namesAddr + tileX];
 
-    uint8_t colorByte = tms9918->vram[tmsPatternTableAddr(tms9918) + pattern * 8 + patternRow];
+    uint8_t colorByte = tms9918->vram[patternBaseAddr + pattern * 8 + patternRow];
 
-    for (int i = 0; i < 4; ++i) pixels[++pixelIndex] = tmsFgColor(tms9918, colorByte);
-    for (int i = 0; i < 4; ++i) pixels[++pixelIndex] = tmsBgColor(tms9918, colorByte);
+    fgColors[tileX] = tmsFgColor(tms9918, colorByte);
+    bgColors[tileX] = tmsBgColor(tms9918, colorByte);
   }
 
+  tmsExpandTiles(pixels, halves, fgColors, bgColors, GRAPHICS_NUM_COLS);
+
   vrEmuTms9918OutputSprites(tms9918, y, pixels);
 }
 
 
-/* Function:  vrEmuTms9918ScanLine
+/* Function:  vrEmuTms9918RenderLine
  * ----------------------------------------
- * generate a scanline
+ * generate a scanline's pixels, leaving the status register alone
  */
- void vrEmuTms9918ScanLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+ void vrEmuTms9918RenderLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
 {
   if (tms9918 == NULL)
     return;
 
-  if (!vrEmuTms9918DisplayEnabled(tms9918) || y >= TMS9918_PIXELS_Y)
+  if (!tms9918->displayEnabled || y >= TMS9918_PIXELS_Y)
   {
-    memset(pixels, tmsMainBgColor(tms9918), TMS9918_PIXELS_X);
+    memset(pixels, tms9918->bgColor, TMS9918_PIXELS_X);
     return;
   }
 
@@ -633,6 +1128,25 @@ static void vrEmuTms9918MulticolorScanLine(VrEmuTms9918* tms9918, uint8_t y, uin
       vrEmuTms9918MulticolorScanLine(tms9918, y, pixels);
       break;
   }
+}
+
+/* Function:  vrEmuTms9918ScanLineStatus
+ * ----------------------------------------
+ * update the status register for a scanline without generating it
+ */
+ void vrEmuTms9918ScanLineStatus(VrEmuTms9918* tms9918, uint8_t y)
+{
+  if (tms9918 == NULL)
+    return;
+
+  /* a blanked display doesn't even raise the interrupt flag */
+  if (!tms9918->displayEnabled || y >= TMS9918_PIXELS_Y)
+    return;
+
+  if (tms9918->mode != TMS_MODE_TEXT)
+  {
+    vrEmuTms9918SpriteStatus(tms9918, y);
+  }
 
   if (y == TMS9918_PIXELS_Y - 1)
   {
@@ -640,6 +1154,41 @@ static void vrEmuTms9918MulticolorScanLine(VrEmuTms9918* tms9918, uint8_t y, uin
   }
 }
 
+/* Function:  vrEmuTms9918ScanLine
+ * ----------------------------------------
+ * generate a scanline
+ */
+ void vrEmuTms9918ScanLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+{
+  vrEmuTms9918RenderLine(tms9918, y, pixels);
+  vrEmuTms9918ScanLineStatus(tms9918, y);
+}
+
+/* Function:  vrEmuTms9918RenderLineArgb
+ * ----------------------------------------
+ * generate a scanline's pixels as 32-bit colors, leaving the status
+ * register alone
+ *
+ * The line is still drawn as color numbers first and looked up in one
+ * pass: the tile kernels and the expanded pattern cache work eight 8-bit
+ * pixels to a word, and the indexed path shares them, so a 256-entry
+ * lookup from L1 costs less than a second, 32-bit copy of every mode.
+ */
+ void vrEmuTms9918RenderLineArgb(VrEmuTms9918* tms9918, uint8_t y, const uint32_t palette[16], uint32_t pixels[TMS9918_PIXELS_X])
+{
+  uint8_t indexes[TMS9918_PIXELS_X];
+
+  if (tms9918 == NULL)
+    return;
+
+  vrEmuTms9918RenderLine(tms9918, y, indexes);
+
+  for (int x = 0; x < TMS9918_PIXELS_X; ++x)
+  {
+    pixels[x] = palette[indexes[x]];
+  }
+}
+
 /* Function:  vrEmuTms9918RegValue
  * ----------------------------------------
  * return a reigister value
@@ -662,8 +1211,8 @@ void vrEmuTms9918WriteRegValue(VrEmuTms9918* tms9918, vrEmuTms9918Register reg,
 {
   if (tms9918 != NULL)
   {
-    tms9918->registers[reg & 0x07] = value;
-    tms9918->mode = tmsMode(tms9918);
+    tmsLog(tms9918, TMS_LOG_REG | ((reg & 0x07) << 8) | value);
+    tmsWriteRegister(tms9918, reg & 0x07, value);
   }
 }
 
@@ -682,6 +1231,131 @@ uint8_t vrEmuTms9918VramValue(VrEmuTms9918* tms9918, uint16_t addr)
   return tms9918->vram[addr & 0x3fff];
 }
 
+/* Function:  vrEmuTms9918SetLog
+ * ----------------------------------------
+ * start recording commands into log (or stop, if it is NULL)
+ */
+void vrEmuTms9918SetLog(VrEmuTms9918* tms9918, uint32_t* log, int size)
+{
+  if (tms9918 == NULL)
+    return;
+
+  tms9918->log = log;
+  tms9918->logSize = size;
+  tms9918->logLength = 0;
+  tms9918->logOverflow = false;
+}
+
+/* Function:  vrEmuTms9918LogLength
+ * ----------------------------------------
+ * number of commands recorded, or -1 if the log filled up
+ */
+int vrEmuTms9918LogLength(VrEmuTms9918* tms9918)
+{
+  if (tms9918 == NULL)
+    return 0;
+
+  return tms9918->logOverflow ? -1 : tms9918->logLength;
+}
+
+/* Function:  vrEmuTms9918LogMark
+ * ----------------------------------------
+ * record a marker of the caller's own
+ */
+void vrEmuTms9918LogMark(VrEmuTms9918* tms9918, uint16_t value)
+{
+  if (tms9918 != NULL)
+  {
+    tmsLog(tms9918, TMS_LOG_MARK | value);
+  }
+}
+
+/* Function:  vrEmuTms9918Replay
+ * ----------------------------------------
+ * apply recorded commands, stopping at a marker
+ */
+int vrEmuTms9918Replay(VrEmuTms9918* tms9918, const uint32_t* log, int count)
+{
+  if (tms9918 == NULL)
+    return count;
+
+  for (int i = 0; i < count; ++i)
+  {
+    uint16_t arg = TMS_LOG_ARG(log[i]);
+
+    switch (TMS_LOG_OP(log[i]))
+    {
+      case TMS_LOG_ADDR:
+        vrEmuTms9918WriteAddr(tms9918, (uint8_t)arg);
+        break;
+
+      case TMS_LOG_DATA:
+        vrEmuTms9918WriteData(tms9918, (uint8_t)arg);
+        break;
+
+      case TMS_LOG_READ:
+        tms9918->currentAddress++;
+        break;
+
+      case TMS_LOG_REG:
+        vrEmuTms9918WriteRegValue(tms9918, (vrEmuTms9918Register)(arg >> 8), (uint8_t)arg);
+        break;
+
+      case TMS_LOG_RESET:
+        vrEmuTms9918Reset(tms9918);
+        break;
+
+      case TMS_LOG_MARK:
+        return i;
+    }
+  }
+
+  return count;
+}
+
+/* Function:  vrEmuTms9918CopyState
+ * ----------------------------------------
+ * make dst a copy of src (apart from its log), everything dirty
+ */
+void vrEmuTms9918CopyState(VrEmuTms9918* dst, VrEmuTms9918* src)
+{
+  uint32_t* log;
+  int logSize;
+
+  if (dst == NULL || src == NULL)
+    return;
+
+  log = dst->log;
+  logSize = dst->logSize;
+  memcpy(dst, src, sizeof(VrEmuTms9918));
+  vrEmuTms9918SetLog(dst, log, logSize);
+
+  tmsMarkAllDirty(dst, TMS_DIRTY_NAME | TMS_DIRTY_PATTERN | TMS_DIRTY_COLOR |
+                       TMS_DIRTY_SPRITES | TMS_DIRTY_REGS);
+}
+
+/* Function:  vrEmuTms9918TakeDirty
+ * ----------------------------------------
+ * return and clear what changed since the last call
+ */
+
+uint8_t vrEmuTms9918TakeDirty(VrEmuTms9918* tms9918, uint32_t* rows)
+{
+  uint8_t flags;
+
+  if (tms9918 == NULL)
+    return 0;
+
+  flags = tms9918->dirtyFlags;
+  if (rows)
+    *rows = tms9918->dirtyRows;
+
+  tms9918->dirtyFlags = 0;
+  tms9918->dirtyRows = 0;
+
+  return flags;
+}
+
 /* Function:  vrEmuTms9918DisplayEnabled
   * --------------------
   * check BLANK flag
@@ -692,5 +1366,5 @@ bool vrEmuTms9918DisplayEnabled(VrEmuTms9918* tms9918)
   if (tms9918 == NULL)
     return false;
 
-  return tms9918->registers[TMS_REG_1] & 0x40;
+  return tms9918->displayEnabled;
 }
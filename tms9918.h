@@ -88,6 +88,28 @@ typedef enum
 #define TMS9918_PIXELS_X 256
 #define TMS9918_PIXELS_Y 192
 
+/* vrEmuTms9918TakeDirty flags */
+#define TMS_DIRTY_NAME      0x01
+#define TMS_DIRTY_PATTERN   0x02
+#define TMS_DIRTY_COLOR     0x04
+#define TMS_DIRTY_SPRITES   0x08
+#define TMS_DIRTY_REGS      0x10
+
+/* one bit per 8-pixel character row */
+#define TMS_DIRTY_ALL_ROWS  0x00ffffff
+
+/* vrEmuTms9918SetLog entries: the operation in the top half, its argument
+   in the bottom */
+#define TMS_LOG_ADDR        0x00000000  /* WriteAddr (data) */
+#define TMS_LOG_DATA        0x00010000  /* WriteData (data) */
+#define TMS_LOG_READ        0x00020000  /* ReadData */
+#define TMS_LOG_REG         0x00030000  /* WriteRegValue (reg << 8 | value) */
+#define TMS_LOG_RESET       0x00040000  /* Reset */
+#define TMS_LOG_MARK        0x00050000  /* LogMark (value) */
+
+#define TMS_LOG_OP(e)       ((e) & 0xffff0000)
+#define TMS_LOG_ARG(e)      ((e) & 0x0000ffff)
+
 
 /* PUBLIC INTERFACE
  * ---------------------------------------- */
@@ -165,6 +187,33 @@ uint8_t vrEmuTms9918ReadDataNoInc(VrEmuTms9918* tms9918);
 
 void vrEmuTms9918ScanLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X]);
 
+/* Function:  vrEmuTms9918ScanLineStatus
+ * ----------------------------------------
+ * update the status register (sprite flags, interrupt) for a scanline
+ * without generating its pixels
+ */
+
+void vrEmuTms9918ScanLineStatus(VrEmuTms9918* tms9918, uint8_t y);
+
+/* Function:  vrEmuTms9918RenderLine
+ * ----------------------------------------
+ * generate a scanline's pixels only, leaving the status register alone.
+ * vrEmuTms9918ScanLine is this plus vrEmuTms9918ScanLineStatus; the two
+ * halves may be run at different times, as long as nothing is written to
+ * the TMS9918 in between
+ */
+
+void vrEmuTms9918RenderLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X]);
+
+/* Function:  vrEmuTms9918RenderLineArgb
+ * ----------------------------------------
+ * as vrEmuTms9918RenderLine, but straight into a 32-bit destination row
+ *
+ * palette: 16 colors (any 32-bit format) indexed by vrEmuTms9918Color
+ */
+
+void vrEmuTms9918RenderLineArgb(VrEmuTms9918* tms9918, uint8_t y, const uint32_t palette[16], uint32_t pixels[TMS9918_PIXELS_X]);
+
 /* Function:  vrEmuTms9918RegValue
  * ----------------------------------------
  * return a reigister value
@@ -188,6 +237,64 @@ void vrEmuTms9918WriteRegValue(VrEmuTms9918* tms9918, vrEmuTms9918Register reg,
 uint8_t vrEmuTms9918VramValue(VrEmuTms9918* tms9918, uint16_t addr);
 
 
+/* Function:  vrEmuTms9918SetLog
+ * ----------------------------------------
+ * start recording every command that changes vram, registers or the
+ * address pointer into log (TMS_LOG_* entries), so that a second
+ * TMS9918 can be kept in step with vrEmuTms9918Replay.  the length
+ * starts over at 0.  pass NULL to stop recording
+ *
+ * size: number of entries log can hold
+ */
+
+void vrEmuTms9918SetLog(VrEmuTms9918* tms9918, uint32_t* log, int size);
+
+/* Function:  vrEmuTms9918LogLength
+ * ----------------------------------------
+ * return the number of entries recorded, or -1 if the log overflowed
+ * (in which case the log is incomplete and a replica must be resynced
+ * with vrEmuTms9918CopyState)
+ */
+
+int vrEmuTms9918LogLength(VrEmuTms9918* tms9918);
+
+/* Function:  vrEmuTms9918LogMark
+ * ----------------------------------------
+ * record a TMS_LOG_MARK entry, meaningful only to the caller
+ */
+
+void vrEmuTms9918LogMark(VrEmuTms9918* tms9918, uint16_t value);
+
+/* Function:  vrEmuTms9918Replay
+ * ----------------------------------------
+ * apply count logged entries, stopping at the first TMS_LOG_MARK
+ *
+ * returns the index of that mark, or count if there was none
+ */
+
+int vrEmuTms9918Replay(VrEmuTms9918* tms9918, const uint32_t* log, int count);
+
+/* Function:  vrEmuTms9918CopyState
+ * ----------------------------------------
+ * make dst an exact copy of src, except that dst keeps its own log.
+ * dst is marked entirely dirty
+ */
+
+void vrEmuTms9918CopyState(VrEmuTms9918* dst, VrEmuTms9918* src);
+
+
+/* Function:  vrEmuTms9918TakeDirty
+ * ----------------------------------------
+ * return (and clear) the TMS_DIRTY_* flags for what has changed since the
+ * last call
+ *
+ * rows: if not NULL, receives a bit for each character row (0 - 23) whose
+ *       scanlines would now render differently
+ */
+
+uint8_t vrEmuTms9918TakeDirty(VrEmuTms9918* tms9918, uint32_t* rows);
+
+
 /* Function:  vrEmuTms9918DisplayEnabled
   * --------------------
   * check BLANK flag
@@ -0,0 +1,417 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * VDP debug view (F12).
+ *
+ * A second window showing what is in video memory, decoded:
+ *
+ *   top left      the name table, drawn through the patterns and colors
+ *                 as the screen would be, but without sprites
+ *   top right     the pattern table (all three pages in Graphics II)
+ *   middle right  the color table, as the color of each pattern row:
+ *                 foreground on the left, background on the right
+ *   bottom left   the 32 sprites, in attribute table order; those after
+ *                 the end marker ($D0) are greyed out
+ *   bottom right  a map of all 16K, one pixel a byte, colored by which
+ *                 table it falls in (name blue, pattern green, color red,
+ *                 sprite attributes yellow, sprite patterns magenta),
+ *                 bright if non-zero
+ *
+ * Nothing is done unless the window is open.  When it is, each frame takes
+ * a copy of VRAM and the registers, and only the panels whose part of VRAM
+ * (or the registers) changed are redrawn; if nothing did, nothing is
+ * presented either.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL.h>
+#include "vdpview.h"
+
+#define VIEW_W 648
+#define VIEW_H 400
+
+#define NAME_X 0
+#define NAME_Y 0
+#define PATTERN_X 264
+#define PATTERN_Y 0
+#define COLOR_X 264
+#define COLOR_Y 136
+#define SPRITE_X 0
+#define SPRITE_Y 200
+#define MAP_X 264
+#define MAP_Y 272
+
+#define DIRTY_NAME    0x01
+#define DIRTY_PATTERN 0x02
+#define DIRTY_COLOR   0x04
+#define DIRTY_SPRITES 0x08
+#define DIRTY_MAP     0x10
+#define DIRTY_ALL     0x1F
+
+#define GREY   0xFF404040
+#define DKGREY 0xFF202020
+
+static SDL_Window *window;
+static SDL_Renderer *renderer;
+static SDL_Texture *texture;
+static uint32_t pixels[VIEW_H][VIEW_W];
+static int repaint;
+
+static uint8_t vram[16384], shown_vram[16384];
+static uint8_t reg[8], shown_reg[8];
+static const uint32_t *pal;
+
+/* What the registers say, worked out once per redraw */
+static int mode, backdrop;
+static uint16_t name_base, name_size;
+static uint16_t pattern_base, pattern_size;
+static uint16_t color_base, color_size;
+static uint16_t attr_base, spattern_base;
+
+static void open_view (void)
+{
+ char quality[16];
+ const char *q;
+
+ window=SDL_CreateWindow("Marduk VDP", SDL_WINDOWPOS_UNDEFINED,
+                         SDL_WINDOWPOS_UNDEFINED, VIEW_W*2, VIEW_H*2,
+                         SDL_WINDOW_RESIZABLE);
+ if (!window) return;
+ renderer=SDL_CreateRenderer(window, -1, 0);
+ if (!renderer)
+ {
+  SDL_DestroyWindow(window);
+  window=0;
+  return;
+ }
+ SDL_RenderSetLogicalSize(renderer, VIEW_W, VIEW_H);
+
+ /* Sharp pixels here, whatever -s said for the main window */
+ q=SDL_GetHint(SDL_HINT_RENDER_SCALE_QUALITY);
+ snprintf(quality, sizeof(quality), "%s", q?q:"nearest");
+ SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+ texture=SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                           SDL_TEXTUREACCESS_STREAMING, VIEW_W, VIEW_H);
+ SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, quality);
+
+ /* Make sure the first frame draws everything */
+ memset(shown_reg, 0xFF, sizeof(shown_reg));
+ memset(pixels, 0, sizeof(pixels));
+}
+
+static void close_view (void)
+{
+ if (texture) SDL_DestroyTexture(texture);
+ if (renderer) SDL_DestroyRenderer(renderer);
+ if (window) SDL_DestroyWindow(window);
+ texture=0;
+ renderer=0;
+ window=0;
+}
+
+void vdpview_toggle (void)
+{
+ if (window)
+  close_view();
+ else
+  open_view();
+}
+
+/*
+ * Deal with events for the view's own window.  Returns 1 if the event was
+ * for it (and so is not the main window's business).
+ */
+int vdpview_event (SDL_Event *event)
+{
+ if ((!window)||(event->type!=SDL_WINDOWEVENT)||
+     (event->window.windowID!=SDL_GetWindowID(window)))
+  return 0;
+
+ switch (event->window.event)
+ {
+  case SDL_WINDOWEVENT_CLOSE:
+   close_view();
+   break;
+  case SDL_WINDOWEVENT_EXPOSED:
+  case SDL_WINDOWEVENT_SIZE_CHANGED:
+   repaint=1;
+   break;
+ }
+ return 1;
+}
+
+/* A TMS9918 color, with transparent showing the backdrop */
+static uint32_t color (int c)
+{
+ return pal[c?c:backdrop];
+}
+
+static void decode_registers (void)
+{
+ backdrop=(reg[7]&0x0F)?(reg[7]&0x0F):TMS_BLACK;
+
+ if (reg[1]&0x10)
+  mode=TMS_MODE_TEXT;
+ else if (reg[1]&0x08)
+  mode=TMS_MODE_MULTICOLOR;
+ else if (reg[0]&0x02)
+  mode=TMS_MODE_GRAPHICS_II;
+ else
+  mode=TMS_MODE_GRAPHICS_I;
+
+ name_base=(reg[2]&0x0F)<<10;
+ name_size=(mode==TMS_MODE_TEXT)?960:768;
+ if (mode==TMS_MODE_GRAPHICS_II)
+ {
+  pattern_base=(reg[4]&0x04)<<11;
+  pattern_size=0x1800;
+  color_base=(reg[3]&0x80)<<6;
+  color_size=0x1800;
+ }
+ else
+ {
+  pattern_base=(reg[4]&0x07)<<11;
+  pattern_size=0x800;
+  color_base=reg[3]<<6;
+  color_size=(mode==TMS_MODE_GRAPHICS_I)?32:0;
+ }
+ attr_base=(reg[5]&0x7F)<<7;
+ spattern_base=(reg[6]&0x07)<<11;
+}
+
+/*
+ * Foreground (high nybble) and background colors for row r of pattern c
+ * in page p.
+ */
+static uint8_t pattern_colors (int p, int c, int r)
+{
+ switch (mode)
+ {
+  case TMS_MODE_GRAPHICS_I:
+   return vram[color_base+(c>>3)];
+  case TMS_MODE_GRAPHICS_II:
+   return vram[(color_base+(p<<11)+c*8+r)&0x3FFF];
+  default:
+   return reg[7];
+ }
+}
+
+static void draw_name (void)
+{
+ int x, y, r, b, cols, w, p, c;
+
+ for (y=0; y<192; y++)
+  for (x=0; x<256; x++)
+   pixels[NAME_Y+y][NAME_X+x]=pal[backdrop];
+
+ cols=(mode==TMS_MODE_TEXT)?40:32;
+ w=(mode==TMS_MODE_TEXT)?6:8;
+ for (y=0; y<24; y++)
+  for (x=0; x<cols; x++)
+  {
+   c=vram[name_base+y*cols+x];
+   p=(mode==TMS_MODE_GRAPHICS_II)?(y>>3):0;
+
+   for (r=0; r<8; r++)
+   {
+    uint32_t *row=&pixels[NAME_Y+y*8+r][NAME_X+(mode==TMS_MODE_TEXT?8:0)+x*w];
+    uint8_t bits, colors;
+
+    if (mode==TMS_MODE_MULTICOLOR)
+    {
+     colors=vram[(pattern_base+c*8+(y&3)*2+(r>>2))&0x3FFF];
+     for (b=0; b<8; b++)
+      row[b]=color((b<4)?(colors>>4):(colors&0x0F));
+     continue;
+    }
+
+    bits=vram[(pattern_base+(p<<11)+c*8+r)&0x3FFF];
+    colors=pattern_colors(p, c, r);
+    for (b=0; b<w; b++)
+     row[b]=color((bits&(0x80>>b))?(colors>>4):(colors&0x0F));
+   }
+  }
+}
+
+static void draw_patterns (void)
+{
+ int p, c, r, b, pages;
+
+ pages=(mode==TMS_MODE_GRAPHICS_II)?3:1;
+ for (r=0; r<128; r++)
+  for (b=0; b<384; b++)
+   pixels[PATTERN_Y+r][PATTERN_X+b]=DKGREY;
+
+ for (p=0; p<pages; p++)
+  for (c=0; c<256; c++)
+   for (r=0; r<8; r++)
+   {
+    uint32_t *row=&pixels[PATTERN_Y+(c>>4)*8+r][PATTERN_X+p*128+(c&15)*8];
+    uint8_t bits, colors;
+
+    bits=vram[(pattern_base+(p<<11)+c*8+r)&0x3FFF];
+    colors=pattern_colors(p, c, r);
+    if (mode==TMS_MODE_MULTICOLOR)
+     colors=(TMS_WHITE<<4)|TMS_BLACK;
+    for (b=0; b<8; b++)
+     row[b]=color((bits&(0x80>>b))?(colors>>4):(colors&0x0F));
+   }
+}
+
+static void draw_colors (void)
+{
+ int p, c, r, b, pages;
+
+ pages=(mode==TMS_MODE_GRAPHICS_II)?3:1;
+ for (r=0; r<128; r++)
+  for (b=0; b<384; b++)
+   pixels[COLOR_Y+r][COLOR_X+b]=DKGREY;
+ if (mode==TMS_MODE_MULTICOLOR) return;
+
+ for (p=0; p<pages; p++)
+  for (c=0; c<256; c++)
+   for (r=0; r<8; r++)
+   {
+    uint32_t *row=&pixels[COLOR_Y+(c>>4)*8+r][COLOR_X+p*128+(c&15)*8];
+    uint8_t colors=pattern_colors(p, c, r);
+
+    for (b=0; b<8; b++)
+     row[b]=color((b<4)?(colors>>4):(colors&0x0F));
+   }
+}
+
+static void draw_sprites (void)
+{
+ int i, x, y, size, ended;
+
+ size=(reg[1]&0x02)?16:8;
+ ended=0;
+ for (i=0; i<32; i++)
+ {
+  const uint8_t *attr=&vram[(attr_base+i*4)&0x3FFF];
+  int ox=SPRITE_X+(i&7)*18, oy=SPRITE_Y+(i>>3)*18;
+  int name=(size==16)?(attr[2]&0xFC):attr[2];
+  uint32_t ink;
+
+  if (attr[0]==0xD0) ended=1;
+  ink=(attr[3]&0x0F)?pal[attr[3]&0x0F]:GREY;
+
+  for (y=0; y<16; y++)
+   for (x=0; x<16; x++)
+   {
+    uint8_t bits;
+
+    pixels[oy+y][ox+x]=ended?DKGREY:0xFF000000;
+    if ((x>=size)||(y>=size)) continue;
+
+    /* 16x16 sprites are four patterns: top left, bottom left, top right... */
+    bits=vram[(spattern_base+name*8+((x&8)<<1)+y)&0x3FFF];
+    if (bits&(0x80>>(x&7)))
+     pixels[oy+y][ox+x]=ended?GREY:ink;
+   }
+ }
+}
+
+static void draw_map (void)
+{
+ int a;
+
+ for (a=0; a<16384; a++)
+ {
+  uint32_t c;
+
+  if ((a>=name_base)&&(a<name_base+name_size))
+   c=0x4040FF;
+  else if ((a>=attr_base)&&(a<attr_base+128))
+   c=0xFFFF40;
+  else if ((a>=pattern_base)&&(a<pattern_base+pattern_size))
+   c=0x40FF40;
+  else if ((a>=color_base)&&(a<color_base+color_size))
+   c=0xFF4040;
+  else if ((a>=spattern_base)&&(a<spattern_base+0x800))
+   c=0xFF40FF;
+  else
+   c=0xC0C0C0;
+  if (!vram[a])
+   c=(c>>2)&0x3F3F3F;
+  pixels[MAP_Y+(a>>7)][MAP_X+(a&127)]=0xFF000000|c;
+ }
+}
+
+static int changed (uint16_t base, uint16_t size)
+{
+ if (!size) return 0;
+ if (base+size>16384) size=16384-base;
+ return memcmp(vram+base, shown_vram+base, size)!=0;
+}
+
+/*
+ * Called once a frame.  palette is ARGB, as used for the main window.
+ */
+void vdpview_frame (VrEmuTms9918 *vdp, const uint32_t *palette)
+{
+ int i, dirty;
+
+ if (!window) return;
+ pal=palette;
+
+ for (i=0; i<8; i++)
+  reg[i]=vrEmuTms9918RegValue(vdp, i);
+ for (i=0; i<16384; i++)
+  vram[i]=vrEmuTms9918VramValue(vdp, i);
+
+ decode_registers();
+ if (memcmp(reg, shown_reg, 8))
+  dirty=DIRTY_ALL;
+ else if (memcmp(vram, shown_vram, 16384))
+ {
+  dirty=DIRTY_MAP;
+  if (changed(pattern_base, pattern_size))
+   dirty|=DIRTY_PATTERN|DIRTY_NAME;
+  if (changed(color_base, color_size))
+   dirty|=DIRTY_COLOR|DIRTY_PATTERN|DIRTY_NAME;
+  if (changed(name_base, name_size))
+   dirty|=DIRTY_NAME;
+  if (changed(attr_base, 128)||changed(spattern_base, 0x800))
+   dirty|=DIRTY_SPRITES;
+ }
+ else
+  dirty=0;
+
+ if (!dirty&&!repaint) return;
+
+ if (dirty&DIRTY_NAME) draw_name();
+ if (dirty&DIRTY_PATTERN) draw_patterns();
+ if (dirty&DIRTY_COLOR) draw_colors();
+ if (dirty&DIRTY_SPRITES) draw_sprites();
+ if (dirty&DIRTY_MAP) draw_map();
+ memcpy(shown_vram, vram, sizeof(vram));
+ memcpy(shown_reg, reg, sizeof(reg));
+ repaint=0;
+
+ SDL_UpdateTexture(texture, NULL, pixels, sizeof(pixels[0]));
+ SDL_RenderClear(renderer);
+ SDL_RenderCopy(renderer, texture, 0, 0);
+ SDL_RenderPresent(renderer);
+}
@@ -0,0 +1,595 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The video pipeline: everything between the VDP and a finished frame.
+ *
+ * A VIDEO draws the lines of one VDP into a frame of its own, keeping
+ * track of which lines need redrawing and which have changed, and draws
+ * the LEDs that go over it.  All of its state is in the instance, and the
+ * only things shared between instances (the noise, and the palette they
+ * are given) are never written after startup, so any number of them can
+ * be drawing at once on as many threads, one thread to an instance, with
+ * no locking, once video_init() has been called and the first VDP made.
+ * Putting the frame on a screen, or anywhere else, is up to
+ * the caller.
+ *
+ * The emulation side of the VDP (its status register, which has to be
+ * right as the beam goes by) is not drawing, and stays with the caller.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "tms9918.h"
+#include "tms_util.h"
+#include "video.h"
+
+/*
+ * Dirty rows.  Bits 0-23 are the 8-line character rows of the VDP area, as
+ * reported by vrEmuTms9918TakeDirty(); bits 24 and 25 are the top and bottom
+ * borders.  A line is only redrawn if its row is pending, otherwise the last
+ * frame's pixels are still good.  Anything that changes in a row the beam
+ * has already reached is carried over to be redrawn in the next frame too.
+ */
+#define ROW_TOP    0x01000000
+#define ROW_BOTTOM 0x02000000
+#define ROW_ALL    (TMS_DIRTY_ALL_ROWS | ROW_TOP | ROW_BOTTOM)
+
+/*
+ * With -T the frame is drawn by a second thread, from a second VDP that is
+ * kept in step by replaying the real one's command log, a frame behind.
+ * The emulation thread only has to note where each line falls in the log
+ * (and when TV mode changes).
+ *
+ * The log holds a frame, which is at most a few thousand port accesses;
+ * should it ever fill up, the copy is resynced and that frame not drawn.
+ */
+#define RENDER_LOG_SIZE 32768
+#define MARK_TV         0x8000
+
+struct video
+{
+ VrEmuTms9918 *vdp;
+ const uint32_t *palette;
+ int indexed;
+ uint8_t *frame8;
+ uint32_t *frame32;
+ uint32_t *argb8; /* -T with indexed: frame8 looked up, by the render thread */
+
+ /* frame_lo and frame_hi bound the lines redrawn since video_changed() */
+ uint32_t rows_pending, rows_carry;
+ int frame_lo, frame_hi;
+ int frame_drawn, frame_touched;
+ int shown_tv;
+ int skip;
+
+ /* Lines noted but not yet drawn; see video_flush() */
+ int deferring, deferred_first, deferred_last;
+ int deferred_tv[VIDEO_H];
+
+ uint32_t noise_seed;
+
+ int shown_lights;
+ uint32_t overlay[VIDEO_OVERLAY_H][VIDEO_W];
+
+ /* -T */
+ VrEmuTms9918 *render_vdp;
+ uint32_t *render_log, *fill_log;
+ int render_length;
+ SDL_sem *render_go, *render_done;
+ SDL_Thread *render_thread;
+ volatile int render_quit;
+ int logged_tv;
+};
+
+static inline void memset32 (uint32_t *d, uint32_t v, size_t n)
+{
+ while (n--)
+  *d++=v;
+}
+
+#ifdef ALLOW_NTSC_NOISE
+/*
+ * NTSC noise.  Rather than making up every pixel, a block of noise is made
+ * once at startup, and each line is a copy of 320 pixels of it from a
+ * random place.  Each instance picks its places with its own generator.
+ *
+ * noise8 is for the indexed frame, which only has black and white to work
+ * with, like MS-DOS; noise32 is grey levels for the ARGB frame.
+ */
+#define NOISE_ATLAS 16384
+
+static uint8_t noise8[NOISE_ATLAS+VIDEO_W];
+static uint32_t noise32[NOISE_ATLAS+VIDEO_W];
+
+static int noise_offset (VIDEO *v)
+{
+ v->noise_seed=v->noise_seed*1103515245UL+12345;
+ return (v->noise_seed>>16)%NOISE_ATLAS;
+}
+#endif
+
+/* Set up what all instances share.  Call once, before making any. */
+void video_init (void)
+{
+#ifdef ALLOW_NTSC_NOISE
+ int x;
+ uint32_t c;
+
+ for (x=0; x<NOISE_ATLAS+VIDEO_W; x++)
+ {
+  c=rand()&0xFF;
+  noise8[x]=c?UI_WHITE:UI_BLACK;
+  noise32[x]=0xFF000000|(c<<16)|(c<<8)|c;
+ }
+#endif
+}
+
+/*
+ * Fill in the palette used for presenting the frame, ARGB.
+ *
+ * $00-$0F are the TMS9918 colors (stored RGBA by the VDP code), and from
+ * $10 up are the UI colors, numbered the same as in the MS-DOS version.
+ */
+void video_make_palette (uint32_t *palette)
+{
+ int c;
+
+ for (c=0; c<16; c++)
+  palette[c]=0xFF000000|(vrEmuTms9918Palette[c]>>8);
+
+ palette[UI_BLACK] =0xFF000000;
+ palette[UI_RED]   =0xFFCC0000;
+ palette[UI_LGREEN]=0xFF00FF00;
+ palette[UI_LRED]  =0xFFFF0000;
+ palette[UI_YELLOW]=0xFFFFFF00;
+ palette[UI_WHITE] =0xFFFFFFFF;
+ palette[UI_DKGREY]=0xFF333333;
+}
+
+/*
+ * Make a pipeline drawing vdp into a frame of its own, as palette indexes
+ * if indexed, otherwise as ARGB looked up in palette.
+ */
+VIDEO *video_new (VrEmuTms9918 *vdp, const uint32_t *palette, int indexed)
+{
+ VIDEO *v;
+
+ v=calloc(1, sizeof(VIDEO));
+ if (!v) return NULL;
+
+ v->vdp=vdp;
+ v->palette=palette;
+ v->indexed=indexed;
+ if (indexed)
+  v->frame8=calloc(VIDEO_W*VIDEO_H, 1);
+ else
+  v->frame32=calloc(VIDEO_W*VIDEO_H, sizeof(uint32_t));
+ if (!v->frame8&&!v->frame32)
+ {
+  free(v);
+  return NULL;
+ }
+
+ v->rows_pending=ROW_ALL;
+ v->frame_lo=VIDEO_H;
+ v->frame_hi=-1;
+ v->shown_tv=-1;
+ v->deferring=1;
+ v->deferred_first=-1;
+ v->noise_seed=rand();
+ v->shown_lights=-1;
+ v->logged_tv=-1;
+ return v;
+}
+
+/*
+ * Draw one line of the frame from the VDP vdp; tv is ctrlreg bit 1 (clear
+ * for TV mode) as of that line.  Usually vdp is the real VDP, but with -T
+ * it is the render thread's copy, running a frame behind.
+ */
+static void draw_scanline (VIDEO *v, VrEmuTms9918 *vdp, int line, int tv)
+{
+ uint8_t bg;
+ uint32_t rows, row, passed;
+
+ v->frame_drawn=1;
+
+ /* Which row is this, and which have been drawn (or started) by now? */
+ if (line<24)
+ {
+  row=ROW_TOP;
+  passed=ROW_TOP;
+ }
+ else if (line<216)
+ {
+  row=1UL<<((line-24)>>3);
+  passed=ROW_TOP|((row<<1)-1);
+ }
+ else
+ {
+  row=ROW_BOTTOM;
+  passed=ROW_ALL;
+ }
+
+ /* A new backdrop color (or anything else in the registers) hits the borders */
+ if (vrEmuTms9918TakeDirty(vdp, &rows)&TMS_DIRTY_REGS)
+  rows|=ROW_TOP|ROW_BOTTOM;
+
+#ifdef ALLOW_NTSC_NOISE
+ if ((tv!=v->shown_tv)||!tv)
+  rows|=ROW_ALL;
+ v->shown_tv=tv;
+#else
+ (void)tv;
+#endif
+
+ v->rows_pending|=rows;
+ v->rows_carry|=rows&passed;
+
+ if (!(v->rows_pending&row))
+  return;
+ if ((line==23)||(line==239)||((line>=24)&&(line<216)&&((line&7)==7)))
+  v->rows_pending&=~row;
+ if (line<v->frame_lo)
+  v->frame_lo=line;
+ v->frame_hi=line;
+ v->frame_touched=1;
+
+ /*
+  * To note:
+  *
+  * The background color is register 7, AND 0x0F.
+  * The border is 32 pels left and right, 24 top and bottom, thus 256x192 in
+  * a 320x240 frame.
+  */
+ bg=vrEmuTms9918RegValue(vdp, 7)&0x0F;
+ if (v->indexed)
+ {
+  uint8_t *p=&v->frame8[line*VIDEO_W];
+
+  if ((line>=24)&&(line<216))
+  {
+   memset(p, bg, 32);
+   vrEmuTms9918RenderLine(vdp, line-24, p+32);
+   memset(p+288, bg, 32);
+  }
+  else
+   memset(p, bg, VIDEO_W);
+ }
+ else
+ {
+  uint32_t *p=&v->frame32[line*VIDEO_W];
+
+  if ((line>=24)&&(line<216))
+  {
+   memset32(p, v->palette[bg], 32);
+   vrEmuTms9918RenderLineArgb(vdp, line-24, v->palette, p+32);
+   memset32(p+288, v->palette[bg], 32);
+  }
+  else
+   memset32(p, v->palette[bg], VIDEO_W);
+ }
+
+ /* Apparently some third-party software flips this bit incorrectly. */
+#ifdef ALLOW_NTSC_NOISE
+ /*
+  * If the display is in "TV" mode, just spew some NTSC noise into the buffer.
+  *
+  * This actually looks pretty realistic (I grew up in the days of aerials and
+  * 3 major TV networks, and am well acquainted with the appearance of NTSC
+  * noise).
+  */
+ if (!tv)
+ {
+  if (v->indexed)
+   memcpy(&v->frame8[line*VIDEO_W], &noise8[noise_offset(v)], VIDEO_W);
+  else
+   memcpy(&v->frame32[line*VIDEO_W], &noise32[noise_offset(v)],
+          VIDEO_W*sizeof(uint32_t));
+ }
+#endif
+}
+
+static int render_worker (void *data)
+{
+ VIDEO *v=data;
+ int i, tv=0;
+ uint16_t mark;
+
+ while (1)
+ {
+  SDL_SemWait(v->render_go);
+  if (v->render_quit)
+   break;
+
+  for (i=0; ; i++)
+  {
+   i+=vrEmuTms9918Replay(v->render_vdp, &v->render_log[i], v->render_length-i);
+   if (i>=v->render_length)
+    break;
+
+   mark=TMS_LOG_ARG(v->render_log[i]);
+   if (mark&MARK_TV)
+    tv=mark&~MARK_TV;
+   else
+    draw_scanline(v, v->render_vdp, mark, tv);
+  }
+
+  /* Look up what changed here, rather than on the emulation thread */
+  if (v->argb8)
+   for (i=v->frame_lo*VIDEO_W; i<(v->frame_hi+1)*VIDEO_W; i++)
+    v->argb8[i]=v->palette[v->frame8[i]];
+  SDL_SemPost(v->render_done);
+ }
+ return 0;
+}
+
+/* Draw on a thread of our own from now on (-T).  Returns -1 on failure. */
+int video_thread (VIDEO *v)
+{
+ v->render_vdp=vrEmuTms9918New();
+ v->render_log=malloc(RENDER_LOG_SIZE*sizeof(uint32_t));
+ v->fill_log=malloc(RENDER_LOG_SIZE*sizeof(uint32_t));
+ v->render_go=SDL_CreateSemaphore(0);
+ v->render_done=SDL_CreateSemaphore(1); /* nothing to wait for at first */
+ if (!v->render_vdp||!v->render_log||!v->fill_log||!v->render_go||!v->render_done)
+  return -1;
+ if (v->indexed)
+ {
+  v->argb8=calloc(VIDEO_W*VIDEO_H, sizeof(uint32_t));
+  if (!v->argb8) return -1;
+ }
+
+ vrEmuTms9918CopyState(v->render_vdp, v->vdp);
+ vrEmuTms9918SetLog(v->vdp, v->fill_log, RENDER_LOG_SIZE);
+ v->render_thread=SDL_CreateThread(render_worker, "render", v);
+ return v->render_thread?0:-1;
+}
+
+void video_free (VIDEO *v)
+{
+ if (!v) return;
+
+ if (v->render_thread)
+ {
+  SDL_SemWait(v->render_done);
+  v->render_quit=1;
+  SDL_SemPost(v->render_go);
+  SDL_WaitThread(v->render_thread, NULL);
+ }
+ if (v->render_log)
+  vrEmuTms9918SetLog(v->vdp, NULL, 0);
+ if (v->render_vdp) vrEmuTms9918Destroy(v->render_vdp);
+ if (v->render_go) SDL_DestroySemaphore(v->render_go);
+ if (v->render_done) SDL_DestroySemaphore(v->render_done);
+ free(v->render_log);
+ free(v->fill_log);
+ free(v->frame8);
+ free(v->frame32);
+ free(v->argb8);
+ free(v);
+}
+
+/*
+ * The beam has reached line (0-239) of the frame; tv is ctrlreg bit 1.
+ *
+ * Most software only touches the VDP during vblank, so lines aren't drawn
+ * as the beam reaches them, only noted, and then drawn in one pass at the
+ * end of the frame while the VDP's tables are still in the cache.  The
+ * first time the CPU writes to the VDP mid-frame (video_flush()), the lines
+ * so far are drawn as they stood, and the rest of the frame is drawn line
+ * by line.
+ */
+void video_scanline (VIDEO *v, int line, int tv)
+{
+ if ((line<0)||(line>=VIDEO_H)||v->skip)
+  return;
+
+ if (v->render_thread)
+ {
+  if (tv!=v->logged_tv)
+  {
+   vrEmuTms9918LogMark(v->vdp, MARK_TV|tv);
+   v->logged_tv=tv;
+  }
+  vrEmuTms9918LogMark(v->vdp, line);
+ }
+ else if (v->deferring)
+ {
+  if (v->deferred_first<0)
+   v->deferred_first=line;
+  v->deferred_last=line;
+  v->deferred_tv[line]=tv;
+ }
+ else
+  draw_scanline(v, v->vdp, line, tv);
+}
+
+/* The CPU is about to access the VDP; draw anything that was put off. */
+void video_flush (VIDEO *v)
+{
+ int line;
+
+ if (!v->deferring)
+  return;
+ v->deferring=0;
+ if (v->deferred_first<0)
+  return;
+
+ for (line=v->deferred_first; line<=v->deferred_last; line++)
+  draw_scanline(v, v->vdp, line, v->deferred_tv[line]);
+ v->deferred_first=-1;
+}
+
+/*
+ * The beam has left the frame; finish drawing it.  With -T this waits for
+ * the render thread to finish the last frame, which is the one it shows.
+ *
+ * Anything drawn late in this frame is picked up at the top of the next.
+ * A skipped frame leaves everything pending for the next one drawn.
+ */
+void video_end_frame (VIDEO *v)
+{
+ if (v->render_thread)
+  SDL_SemWait(v->render_done);
+ else
+  video_flush(v);
+
+ if (v->frame_drawn)
+ {
+  v->rows_pending=v->rows_carry;
+  v->rows_carry=0;
+  v->frame_drawn=0;
+ }
+}
+
+/*
+ * The next frame starts, and will be drawn unless skip.  With -T, this is
+ * when the render thread is given the frame just logged, so the caller has
+ * to be done with the one it drew.
+ */
+void video_begin_frame (VIDEO *v, int skip)
+{
+ uint32_t *t;
+ int n;
+
+ v->skip=skip;
+ if (!v->render_thread)
+ {
+  v->deferring=1;
+  return;
+ }
+
+ n=vrEmuTms9918LogLength(v->vdp);
+ if (n<0)
+ {
+  vrEmuTms9918CopyState(v->render_vdp, v->vdp);
+  n=0;
+ }
+
+ t=v->render_log;
+ v->render_log=v->fill_log;
+ v->fill_log=t;
+ v->render_length=n;
+ vrEmuTms9918SetLog(v->vdp, v->fill_log, RENDER_LOG_SIZE);
+ SDL_SemPost(v->render_go);
+}
+
+/* The frame, VIDEO_W by VIDEO_H, uint8_t if indexed, otherwise uint32_t */
+const void *video_frame (VIDEO *v)
+{
+ return v->indexed?(void *)v->frame8:(void *)v->frame32;
+}
+
+/*
+ * The frame as ARGB, for showing.  Indexed, that is only kept with -T,
+ * where the render thread does the lookup; otherwise it's NULL, and the
+ * caller has to look frame8 up itself.
+ */
+const uint32_t *video_frame_argb (VIDEO *v)
+{
+ return v->indexed?v->argb8:v->frame32;
+}
+
+/*
+ * Return whether any lines have been redrawn since the last call, and if
+ * so which (*lo to *hi), so that only they need to be shown again.
+ */
+int video_changed (VIDEO *v, int *lo, int *hi)
+{
+ if (v->frame_hi<v->frame_lo)
+  return 0;
+
+ *lo=v->frame_lo;
+ *hi=v->frame_hi;
+ v->frame_lo=VIDEO_H;
+ v->frame_hi=-1;
+ return 1;
+}
+
+/* Return whether anything was redrawn since the last call */
+int video_touched (VIDEO *v)
+{
+ int t;
+
+ t=v->frame_touched;
+ v->frame_touched=0;
+ return t;
+}
+
+/*
+ * The LEDs and other indicators are not part of the frame, which is only
+ * what the VDP shows, but a small ARGB overlay, VIDEO_W by VIDEO_OVERLAY_H,
+ * to lay over the bottom border at VIDEO_OVERLAY_Y.
+ *
+ * lights is ctrlreg bits 3-5, the disk lights << 8 and $400 for the
+ * keyboard joystick.  They appear in the bottom corners, in the order in
+ * which they appear on the system unit: the disk lights on the left, the
+ * keyboard joystick icon and the yellow, red and green LEDs on the right,
+ * as "chewed-out" rectangles.  An unlit LED is still drawn, in black; the
+ * disk lights and the joystick icon only appear when on, and everything
+ * else is left transparent.
+ *
+ * Returns NULL if the overlay hasn't changed since it was last drawn.
+ */
+const uint32_t *video_overlay (VIDEO *v, int lights)
+{
+ static const int led[3]={296, 304, 312};
+ static const uint8_t led_color[3]={UI_YELLOW, UI_LRED, UI_LGREEN};
+ const uint32_t *pal=v->palette;
+ int x, y, t;
+
+ if (lights==v->shown_lights)
+  return NULL;
+ v->shown_lights=lights;
+
+ memset(v->overlay, 0, sizeof(v->overlay));
+ for (y=0; y<VIDEO_OVERLAY_H; y++)
+ {
+  if (lights&0x100)
+   memset32(&v->overlay[y][4], pal[UI_RED], 4);
+  if (lights&0x200)
+   memset32(&v->overlay[y][12], pal[UI_RED], 4);
+
+  for (t=0; t<3; t++)
+  {
+   x=(lights&(0x20>>t))?led_color[t]:UI_BLACK;
+   if ((y==0)||(y==VIDEO_OVERLAY_H-1))
+    memset32(&v->overlay[y][led[t]+1], pal[x], 2);
+   else
+    memset32(&v->overlay[y][led[t]], pal[x], 4);
+  }
+ }
+
+ if (lights&0x400)
+ {
+  v->overlay[0][289]=v->overlay[0][290]=pal[UI_RED];
+  v->overlay[1][289]=v->overlay[1][290]=pal[UI_DKGREY];
+  v->overlay[2][289]=v->overlay[2][290]=pal[UI_DKGREY];
+  v->overlay[2][288]=pal[UI_RED];
+  memset32(&v->overlay[3][288], pal[UI_DKGREY], 4);
+ }
+
+ return &v->overlay[0][0];
+}
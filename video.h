@@ -0,0 +1,65 @@
+/*
+ * Copyright 2023 S. V. Nickolas.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following condition:  The
+ * above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef H_VIDEO
+#define H_VIDEO
+
+#include <stdint.h>
+#include "tms9918.h"
+
+/* The frame: the VDP's 256x192 with its borders, as 8-bit color or ARGB */
+#define VIDEO_W 320
+#define VIDEO_H 240
+
+/* The LED overlay, laid over the bottom border */
+#define VIDEO_OVERLAY_Y 232
+#define VIDEO_OVERLAY_H 4
+
+/* UI colors in the palette, after the 16 VDP colors */
+#define UI_BLACK  0x10
+#define UI_RED    0x14
+#define UI_LGREEN 0x1A
+#define UI_LRED   0x1C
+#define UI_YELLOW 0x1E
+#define UI_WHITE  0x1F
+#define UI_DKGREY 0x20
+
+typedef struct video VIDEO;
+
+void video_init (void);
+void video_make_palette (uint32_t *palette);
+
+VIDEO *video_new (VrEmuTms9918 *vdp, const uint32_t *palette, int indexed);
+int video_thread (VIDEO *v);
+void video_free (VIDEO *v);
+
+void video_scanline (VIDEO *v, int line, int tv);
+void video_flush (VIDEO *v);
+void video_end_frame (VIDEO *v);
+void video_begin_frame (VIDEO *v, int skip);
+
+const void *video_frame (VIDEO *v);
+const uint32_t *video_frame_argb (VIDEO *v);
+int video_changed (VIDEO *v, int *lo, int *hi);
+int video_touched (VIDEO *v);
+const uint32_t *video_overlay (VIDEO *v, int lights);
+
+#endif /* H_VIDEO */